@@ -0,0 +1,128 @@
+//FILE: client/app_multi_client.c
+//
+//Description: this is the client side of the overlay scaling benchmark. It reads the server name, then forks one process per simulated client host. Every process starts its own overlay TCP connection to the server, initializes the SRT client by calling srt_client_init(), connects a SRT socket by calling srt_client_sock() and srt_client_connect(), sends one message of MSGLEN bytes, disconnects by calling srt_client_disconnect() and srt_client_close(), and stops its overlay. The parent waits for all of them and reports how long they took.
+
+//Input: the number of client hosts to simulate (default CONNECTIONS) as the first argument, the server name on stdin
+
+//Output: number of clients that completed and the elapsed time
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common/constants.h"
+#include "srt_client.h"
+
+//every client host uses client port CLIENTPORT1 and server port SVRPORT1 on its own overlay connection
+#define CLIENTPORT1 87
+#define SVRPORT1 88
+//number of client hosts simulated when no argument is given
+#define CONNECTIONS 100
+//length of the message every client sends, the server app uses the same value
+#define MSGLEN 4096
+
+//this function starts the overlay by creating a direct TCP connection to the server at servaddr. The TCP socket descriptor is returned. If the TCP connection fails, return -1.
+int overlay_start(struct sockaddr_in* servaddr) {
+	int out_conn = socket(AF_INET,SOCK_STREAM,0);
+	if(out_conn<0) {
+		printf("socket creation failed\n");
+		return -1;
+	}
+	if(connect(out_conn, (struct sockaddr*)servaddr, sizeof(*servaddr))<0){
+		printf("Overlay connect failed\n");
+		close(out_conn);
+		return -1;
+	}
+	return out_conn;
+}
+
+//this function stops the overlay by closing the TCP connection between the server and the client
+void overlay_stop(int overlay_conn) {
+	close(overlay_conn);
+}
+
+//one simulated client host: connect, send a message filled with the letter of its index, disconnect
+int run_client(struct sockaddr_in* servaddr, int index) {
+	char buf[MSGLEN];
+
+	int overlay_conn = overlay_start(servaddr);
+	if(overlay_conn<0)
+		return 1;
+	srt_client_init(overlay_conn);
+
+	int sockfd = srt_client_sock(CLIENTPORT1);
+	if(sockfd<0 || srt_client_connect(sockfd,SVRPORT1)<0) {
+		printf("client %d: fail to connect to srt server\n", index);
+		return 1;
+	}
+	memset(buf, 'a' + index % 26, sizeof(buf));
+	srt_client_send(sockfd, buf, sizeof(buf));
+
+	if(srt_client_disconnect(sockfd)<0 || srt_client_close(sockfd)<0) {
+		printf("client %d: fail to disconnect from srt server\n", index);
+		return 1;
+	}
+	overlay_stop(overlay_conn);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	struct sockaddr_in servaddr;
+	struct hostent *hostInfo;
+	char hostname_buf[50];
+
+	int connections = argc > 1 ? atoi(argv[1]) : CONNECTIONS;
+	if(connections <= 0) {
+		printf("usage: %s [connections]\n", argv[0]);
+		exit(1);
+	}
+
+	printf("Enter server name to connect:");
+	scanf("%49s",hostname_buf);
+	hostInfo = gethostbyname(hostname_buf);
+	if(!hostInfo) {
+		printf("host name error!\n");
+		exit(1);
+	}
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin_family = hostInfo->h_addrtype;
+	memcpy((char *) &servaddr.sin_addr.s_addr, hostInfo->h_addr_list[0], hostInfo->h_length);
+	servaddr.sin_port = htons(OVERLAY_PORT);
+	fflush(stdout);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	//start every client host in its own process
+	for(int i = 0; i < connections; i++) {
+		pid_t pid = fork();
+		if(pid == 0) {
+			fclose(stdin);
+			exit(run_client(&servaddr, i));
+		}
+		if(pid < 0) {
+			printf("fork failed after %d clients\n", i);
+			connections = i;
+			break;
+		}
+	}
+
+	int done = 0;
+	int status;
+	while(wait(&status) > 0) {
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			done++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d of %d clients completed in %.3f s\n", done, connections, secs);
+	return done == connections ? 0 : 1;
+}
@@ -110,13 +110,13 @@ int main() {
 
 	int i;
 	for(i=0;i<5;i++){
-      		srt_client_send(sockfd, mydata, 6);
+      		srt_client_send(sockfd, mydata, strlen(mydata));
 			printf("send string:%s to connection 1\n",mydata);	
       	}
 	//send strings through the second connection
   	char mydata2[7] = "byebye";
 	for(i=0;i<5;i++){
-      		srt_client_send(sockfd2, mydata2, 7);
+      		srt_client_send(sockfd2, mydata2, strlen(mydata2));
 			printf("send string:%s to connection 2\n",mydata2);	
       	}
 
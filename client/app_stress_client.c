@@ -1,6 +1,6 @@
 //FILE: client/app_stress_client.c
 
-//Description: this is the stress test client application code. The client first starts the overlay by creating a direct TCP link between the client and the server. Then it initializes the SRT client by calling srt_client_init(). It creates a socket and connects to the server  by calling srt_client_sock() and srt_client_connect(). Then it reads text data from file send_this_text.txt, and sends the length of the file and file data to the server. After some time, the client disconnects from the server by calling srt_client_disconnect(). Finally the client closes the socket by calling srt_client_close(). Overlay is stopped by calling overlay_end().
+//Description: this is the stress test client application code. The client first starts the overlay by creating a direct TCP link between the client and the server. Then it initializes the SRT client by calling srt_client_init(). It creates a socket and connects to the server  by calling srt_client_sock() and srt_client_connect(). Then it opens file send_this_text.txt, sends the length of the file as a binary int, and sends the file data to the server by calling srt_client_sendfile(), which maps the file piece by piece instead of reading it into memory. With SRT_STRESS_BYTES set it streams that many generated bytes instead, see send_stream(), and with SRT_STRESS_MSG it sends the generated stream as many small messages, see send_messages(). After some time, the client disconnects from the server by calling srt_client_disconnect(). Finally the client closes the socket by calling srt_client_close(). Overlay is stopped by calling overlay_end().
 
 //Date: April 26, 2016
 
@@ -18,7 +18,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "../common/constants.h"
+#include "../common/slab.h"
 #include "srt_client.h"
 
 //One connection is created using client port CLIENTPORT1 and server port SVRPORT1. 
@@ -26,8 +30,14 @@
 #define SVRPORT1 88
 //after the file is sent, the client waits for WAITTIME seconds, and then closes the connection
 #define WAITTIME 8
+//the generated stream of SRT_STRESS_BYTES is sent STREAM_CHUNK bytes at a time, must be a multiple of 8
+#define STREAM_CHUNK 65536
+//the small messages of SRT_STRESS_MSG are at most MSG_MAX bytes, and must all be ACKed within MSG_ACKWAIT seconds
+#define MSG_MAX 65536
+#define MSG_ACKWAIT 30
 
 //this function starts the overlay by creating a direct TCP connection between the client and the server. The TCP socket descriptor is returned. If the TCP connection fails, return -1. The TCP socket descriptor returned will be used by SRT to send segments.
+//if the SRT_OVERLAY environment variable is set to udp, a UDP socket connected to the server is used instead and every segment travels in its own datagram.
 int overlay_start() {
 	int out_conn;
 	struct sockaddr_in servaddr;
@@ -47,7 +57,9 @@ int overlay_start() {
 	memcpy((char *) &servaddr.sin_addr.s_addr, hostInfo->h_addr_list[0], hostInfo->h_length);
 	servaddr.sin_port = htons(OVERLAY_PORT);
 
-	out_conn = socket(AF_INET,SOCK_STREAM,0);  
+	char* overlay = getenv("SRT_OVERLAY");
+	int udp = overlay != NULL && strcmp(overlay, "udp") == 0;
+	out_conn = socket(AF_INET,udp ? SOCK_DGRAM : SOCK_STREAM,0);  
 	if(out_conn<0) {
 		printf("socket creation failed\n");
 		return -1;
@@ -56,6 +68,11 @@ int overlay_start() {
 		printf("Overlay connect failed\n");
 		return -1; 
 	}
+	if(udp) {
+		int bufsize = OVERLAY_UDP_BUFSIZE;
+		setsockopt(out_conn, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+		setsockopt(out_conn, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	}
 	return out_conn;
 }
 
@@ -64,6 +81,88 @@ void overlay_stop(int overlay_conn) {
 	close(overlay_conn);
 }
 
+//with SRT_STRESS_BYTES set, the client sends -1 for the file length and then that many generated
+//bytes instead of the file, so one connection can carry many times the 4 GB after which sequence
+//numbers wrap. Every 8-byte word of the stream holds its own offset in the stream, so the server
+//can tell where a byte was lost, repeated or misplaced.
+void send_stream(int sockfd, unsigned long long total) {
+	int marker = -1;
+	unsigned long long* buf = malloc(STREAM_CHUNK);
+	struct timespec start, end;
+	assert(buf != NULL);
+	srt_client_send(sockfd, &marker, sizeof(int));
+	srt_client_send(sockfd, &total, sizeof(total));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(unsigned long long off = 0; off < total; off += STREAM_CHUNK) {
+		unsigned int n = total - off < STREAM_CHUNK ? total - off : STREAM_CHUNK;
+		for(unsigned int i = 0; i < STREAM_CHUNK / 8; i++)
+			buf[i] = off + i * 8;
+		if(srt_client_send(sockfd, buf, n) < 0) {
+			printf("fail to send stream at offset %llu\n", off);
+			exit(1);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("queued %llu stream bytes in %.3f s (%.3f MB/s)\n", total, secs, total / secs / 1e6);
+	free(buf);
+}
+
+//the small-message benchmark: SRT_STRESS_MSG=size:count[:cork] sends count messages of size bytes
+//with one srt_client_send() each, then srt_client_flush(), and waits until all of them are ACKed.
+//With cork given the socket coalesces small writes for that many microseconds, see srt_client_setcork(),
+//otherwise it keeps the SRT_CORK default. The messages make up the generated stream of send_stream(),
+//so the server checks them the same way. It prints messages per second and the bytes written to
+//the overlay per payload byte, from snp_getstats().
+void send_messages(int sockfd, int overlay_conn, char* spec) {
+	unsigned int size = 0, count = 0;
+	long long cork = -1;
+	if(sscanf(spec, "%u:%u:%lld", &size, &count, &cork) < 2 || size == 0 || size > MSG_MAX) {
+		printf("SRT_STRESS_MSG: expected size:count[:cork], size from 1 to %d\n", MSG_MAX);
+		exit(1);
+	}
+	if(cork >= 0)
+		srt_client_setcork(sockfd, cork * 1000);
+
+	int marker = -1;
+	unsigned long long total = (unsigned long long)size * count;
+	unsigned char* msg = malloc(size);
+	assert(msg != NULL);
+	srt_client_send(sockfd, &marker, sizeof(int));
+	srt_client_send(sockfd, &total, sizeof(total));
+	srt_client_flush(sockfd);
+
+	snp_stats_t before, after;
+	struct timespec start, end;
+	unsigned long long queued, acked;
+	snp_getstats(overlay_conn, &before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(unsigned long long off = 0; off < total; off += size) {
+		//byte b of the stream is byte b % 8 of the 8-byte word that holds b rounded down to 8
+		for(unsigned int i = 0; i < size; i++) {
+			unsigned long long word = (off + i) & ~7ULL;
+			msg[i] = ((unsigned char*)&word)[(off + i) & 7];
+		}
+		if(srt_client_send(sockfd, msg, size) < 0) {
+			printf("fail to send message at offset %llu\n", off);
+			exit(1);
+		}
+	}
+	srt_client_flush(sockfd);
+	do {
+		usleep(100);
+		srt_client_getoffsets(sockfd, &queued, &acked);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	} while(acked < queued && end.tv_sec - start.tv_sec < MSG_ACKWAIT);
+	snp_getstats(overlay_conn, &after);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	unsigned long wire = after.tx_bytes - before.tx_bytes;
+	printf("small messages: %u of %u bytes%s ACKed in %.3f s (%.0f msgs/s), %lu segments, %lu bytes on the wire (%.3f per payload byte)\n",
+		count, size, acked < queued ? " not all" : "", secs, count / secs, after.tx_segs - before.tx_segs, wire, total ? (double)wire / total : 0.0);
+	free(msg);
+}
+
 int main() {
 	//random seed for loss rate
 	srand(time(NULL));
@@ -74,6 +173,12 @@ int main() {
 		printf("fail to start overlay\n");
 		exit(1);
 	}
+	//with SRT_OVERLAY=shm the server runs on this host and segments go through shared memory
+	char* overlay = getenv("SRT_OVERLAY");
+	if(overlay != NULL && strcmp(overlay, "shm") == 0 && snp_shm_start(overlay_conn, 0) < 0) {
+		printf("fail to start shared memory overlay\n");
+		exit(1);
+	}
 
 	//initialize srt client
 	srt_client_init(overlay_conn);
@@ -90,32 +195,64 @@ int main() {
 	}
 	printf("client connected to server, client port:%d, server port %d\n",CLIENTPORT1,SVRPORT1);
 	
-	//get sampletext.txt file length,
-	//create a buffer and read the file data in
-	FILE *f;
-	f = fopen("send_this_text.txt","r");
-	assert(f!=NULL);
-	fseek(f,0,SEEK_END);
-	int fileLen = ftell(f);
-	fseek(f,0,SEEK_SET);
-	char *buffer = (char*)malloc(fileLen);
-	char fileLenS[4];
-	sprintf(fileLenS, "%d", fileLen);
-	fread(buffer,fileLen,1,f);
-	fclose(f);
-
-	//send file length first, then send the whole file
-	srt_client_send(sockfd,&fileLenS,sizeof(int));
-      	srt_client_send(sockfd, buffer, fileLen);
-	free(buffer);
+	//open send_this_text.txt and get its length
+	int fd = open("send_this_text.txt", O_RDONLY);
+	assert(fd>=0);
+	struct stat st;
+	fstat(fd, &st);
+	int fileLen = st.st_size;
+
+	char* streamBytes = getenv("SRT_STRESS_BYTES");
+	char* messages = getenv("SRT_STRESS_MSG");
+	if(messages != NULL) {
+		send_messages(sockfd, overlay_conn, messages);
+	}
+	else if(streamBytes != NULL) {
+		send_stream(sockfd, strtoull(streamBytes, NULL, 10));
+	}
+	else {
+		//send file length first, then let the SRT client send the file straight from the page cache
+		srt_client_send(sockfd,&fileLen,sizeof(int));
+		if(srt_client_sendfile(sockfd, fd, 0, fileLen) != fileLen) {
+			printf("fail to send file\n");
+			exit(1);
+		}
+	}
 
 	//wait for a while and close the connections
 	sleep(WAITTIME);
 
+	//report overlay transmit statistics
+	snp_stats_t stats;
+	snp_getstats(overlay_conn, &stats);
+	printf("overlay: %lu segments, %lu bytes, %lu send syscalls (%.2f per segment)\n",
+		stats.tx_segs, stats.tx_bytes, stats.tx_syscalls,
+		stats.tx_segs ? (double)stats.tx_syscalls / stats.tx_segs : 0.0);
+	printf("checksum kernel: %s\n", checksum_kernel());
+	printf("io engine: %s\n", snp_getengine(overlay_conn) == SNP_ENGINE_URING ? "io_uring" : "syscall");
+	srt_cc_t cc;
+	srt_client_getcc(sockfd, &cc);
+	printf("segment size: %u\n", cc.mss);
+	slab_print();
+
+	//report the RTT estimate of the connection
+	srt_rtt_t rtt;
+	srt_client_getrtt(sockfd, &rtt);
+	printf("rtt: srtt %.3f ms, rttvar %.3f ms, rto %.3f ms, %lu samples, %lu timeouts, %lu fast retransmits, %lu window probes\n",
+		rtt.srtt / 1e6, rtt.rttvar / 1e6, rtt.rto / 1e6, rtt.samples, rtt.timeouts, rtt.fastrtx, rtt.probes);
+	//and how far its congestion window grew, and how often losses cut it back
+	printf("congestion control: %s, cwnd %u bytes (%.1f segments), ssthresh %u, peak cwnd %u (%.1f segments), %lu loss and %lu timeout reductions\n",
+		cc.ops->name, cc.cwnd, (double)cc.cwnd / cc.mss, cc.ssthresh, cc.maxcwnd, (double)cc.maxcwnd / cc.mss, cc.losses, cc.timeouts);
+
 	if(srt_client_disconnect(sockfd)<0) {
 		printf("fail to disconnect from srt server\n");
 		exit(1);
 	}
+	unsigned long long queued, acked;
+	srt_client_getoffsets(sockfd, &queued, &acked);
+	printf("stream offsets: %llu bytes queued, %llu ACKed\n", queued, acked);
+	//the disconnect waited for every byte to be ACKed, so the file is no longer mapped
+	close(fd);
 	if(srt_client_close(sockfd)<0) {
 		printf("fail to close srt client\n");
 		exit(1);
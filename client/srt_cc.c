@@ -0,0 +1,200 @@
+//FILE: client/srt_cc.c
+//
+//Description: congestion control algorithms of the SRT client, Reno style AIMD and CUBIC
+//
+
+#include <string.h>
+#include <math.h>
+#include "../common/constants.h"
+#include "srt_cc.h"
+
+//CUBIC window growth constant, in segments per second cubed, and multiplicative decrease
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+//slow start grows the window by the bytes ACKed, but by at most two segments per ACK, so an
+//ACK that covers a long run of segments after a loss does not burst (RFC 3465)
+static void slowstart(srt_cc_t* cc, unsigned int acked)
+{
+	cc->cwnd += acked < 2 * cc->mss ? acked : 2 * cc->mss;
+}
+
+//half the data in flight, but at least two segments
+static unsigned int halfflight(srt_cc_t* cc, unsigned int flight)
+{
+	return flight / 2 > 2 * cc->mss ? flight / 2 : 2 * cc->mss;
+}
+
+static void reno_init(srt_cc_t* cc)
+{
+	cc->ssthresh = CWND_MAX_SEGS * cc->mss;
+	cc->acked = 0;
+}
+
+static void reno_ack(srt_cc_t* cc, unsigned int acked, long long srtt, long long now)
+{
+	if (cc->cwnd < cc->ssthresh){
+		slowstart(cc, acked);
+		return;
+	}
+	// One segment more for every window of bytes ACKed
+	cc->acked += acked;
+	if (cc->acked >= cc->cwnd){
+		cc->acked -= cc->cwnd;
+		cc->cwnd += cc->mss;
+	}
+}
+
+static void reno_loss(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cc->ssthresh = halfflight(cc, flight);
+	cc->cwnd = cc->ssthresh;
+	cc->acked = 0;
+}
+
+static void reno_timeout(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cc->ssthresh = halfflight(cc, flight);
+	cc->cwnd = cc->mss;
+	cc->acked = 0;
+}
+
+static void cubic_init(srt_cc_t* cc)
+{
+	cc->ssthresh = CWND_MAX_SEGS * cc->mss;
+	cc->wmax = 0;
+	cc->epoch = 0;
+	cc->k = 0;
+}
+
+static void cubic_ack(srt_cc_t* cc, unsigned int acked, long long srtt, long long now)
+{
+	if (cc->cwnd < cc->ssthresh){
+		slowstart(cc, acked);
+		return;
+	}
+	if (srtt <= 0){
+		srtt = RTO_INIT;
+	}
+
+	// A growth period starts at the first ACK after a reduction. Below wmax the window
+	// climbs back to it in k seconds; above it, it probes from the current window.
+	if (cc->epoch == 0){
+		cc->epoch = now;
+		if (cc->cwnd < cc->wmax){
+			cc->k = cbrt((double)(cc->wmax - cc->cwnd) / cc->mss / CUBIC_C);
+		}
+		else{
+			cc->k = 0;
+			cc->wmax = cc->cwnd;
+		}
+	}
+
+	// The cubic target one RTT from now, and the window Reno would have reached since the
+	// reduction, so that CUBIC is never slower than Reno on short RTTs
+	double t = (now - cc->epoch + srtt) / 1e9;
+	double target = cc->wmax + CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k) * cc->mss;
+	double reno = cc->wmax * CUBIC_BETA + 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * (double)(now - cc->epoch) / srtt * cc->mss;
+	if (target < reno){
+		target = reno;
+	}
+	if (target > 1.5 * cc->cwnd){
+		target = 1.5 * cc->cwnd;
+	}
+	if (target > cc->cwnd){
+		cc->cwnd += (unsigned int)((target - cc->cwnd) * acked / cc->cwnd);
+	}
+}
+
+// Remember the window at the loss. If it is below the previous wmax the available capacity
+// shrank, so wmax is lowered further to leave room to other flows (fast convergence).
+static void cubic_reduce(srt_cc_t* cc)
+{
+	if (cc->cwnd < cc->wmax){
+		cc->wmax = cc->cwnd * (1 + CUBIC_BETA) / 2;
+	}
+	else{
+		cc->wmax = cc->cwnd;
+	}
+	cc->ssthresh = cc->cwnd * CUBIC_BETA > 2 * cc->mss ? cc->cwnd * CUBIC_BETA : 2 * cc->mss;
+	cc->epoch = 0;
+}
+
+static void cubic_loss(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cubic_reduce(cc);
+	cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_timeout(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cubic_reduce(cc);
+	cc->cwnd = cc->mss;
+}
+
+static const srt_cc_ops_t ccAlgos[SRT_CC_NUM] = {
+	[SRT_CC_RENO] = { "reno", reno_init, reno_ack, reno_loss, reno_timeout },
+	[SRT_CC_CUBIC] = { "cubic", cubic_init, cubic_ack, cubic_loss, cubic_timeout },
+};
+
+const srt_cc_ops_t* srt_cc_get(int algo)
+{
+	if (algo < 0 || algo >= SRT_CC_NUM){
+		return NULL;
+	}
+	return &ccAlgos[algo];
+}
+
+int srt_cc_find(const char* name)
+{
+	for (int i = 0; i < SRT_CC_NUM; i++){
+		if (strcmp(ccAlgos[i].name, name) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+//keep the window within its bounds and track the largest one
+static void clamp(srt_cc_t* cc)
+{
+	if (cc->cwnd < cc->mss){
+		cc->cwnd = cc->mss;
+	}
+	if (cc->cwnd > CWND_MAX_SEGS * cc->mss){
+		cc->cwnd = CWND_MAX_SEGS * cc->mss;
+	}
+	if (cc->cwnd > cc->maxcwnd){
+		cc->maxcwnd = cc->cwnd;
+	}
+}
+
+void srt_cc_init(srt_cc_t* cc, const srt_cc_ops_t* ops, unsigned int mss)
+{
+	memset(cc, 0, sizeof(srt_cc_t));
+	cc->ops = ops;
+	cc->mss = mss;
+	cc->cwnd = CWND_INIT_SEGS * mss;
+	ops->init(cc);
+	clamp(cc);
+}
+
+void srt_cc_ack(srt_cc_t* cc, unsigned int acked, long long srtt, long long now)
+{
+	cc->ops->on_ack(cc, acked, srtt, now);
+	clamp(cc);
+}
+
+void srt_cc_loss(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cc->ops->on_loss(cc, flight, now);
+	cc->losses++;
+	clamp(cc);
+}
+
+void srt_cc_timeout(srt_cc_t* cc, unsigned int flight, long long now)
+{
+	cc->ops->on_timeout(cc, flight, now);
+	cc->timeouts++;
+	clamp(cc);
+}
@@ -0,0 +1,72 @@
+//
+// FILE: srt_cc.h
+//
+// Description: This file contains the congestion control of the SRT client. A connection
+// keeps at most a congestion window of data bytes in flight, counted from the oldest unACKed
+// byte. The window starts at CWND_INIT_SEGS segments of the connection's segment size, stays
+// between one and CWND_MAX_SEGS of them, and is moved by a congestion control algorithm
+// through three hooks: on_ack when a DATAACK acknowledges new data, on_loss when a segment is
+// fast retransmitted and on_timeout when the oldest segment in flight times out. Every socket picks its algorithm, see srt_client_setcc().
+//
+// Two algorithms are provided. SRT_CC_RENO is Reno style AIMD: slow start doubles the window
+// every RTT up to ssthresh, congestion avoidance adds a segment per window of ACKed bytes, and
+// a loss halves it. SRT_CC_CUBIC grows the window as a cubic function of the time since the
+// last loss, centered on the window at that loss, and cuts it to 70% on a loss (RFC 8312).
+//
+
+#ifndef SRT_CC_H
+#define SRT_CC_H
+
+//congestion control algorithms, see srt_cc_get()
+#define SRT_CC_RENO 0
+#define SRT_CC_CUBIC 1
+#define SRT_CC_NUM 2
+
+typedef struct srt_cc srt_cc_t;
+
+//hooks of a congestion control algorithm. Windows are in bytes and times in nanoseconds;
+//flight is the number of data bytes in flight when the loss is detected
+typedef struct srt_cc_ops {
+	const char* name;
+	void (*init)(srt_cc_t* cc);
+	void (*on_ack)(srt_cc_t* cc, unsigned int acked, long long srtt, long long now);
+	void (*on_loss)(srt_cc_t* cc, unsigned int flight, long long now);
+	void (*on_timeout)(srt_cc_t* cc, unsigned int flight, long long now);
+} srt_cc_ops_t;
+
+//congestion control state of a connection, see srt_client_getcc()
+struct srt_cc {
+	const srt_cc_ops_t* ops;        //the algorithm
+	unsigned int mss;               //data bytes of a full segment of the connection
+	unsigned int cwnd;              //congestion window
+	unsigned int ssthresh;          //slow start threshold, the window grows exponentially below it
+	unsigned int maxcwnd;           //largest congestion window reached
+	unsigned int acked;             //Reno: bytes ACKed in congestion avoidance since the last increase
+	unsigned int wmax;              //CUBIC: window before the last reduction
+	long long epoch;                //CUBIC: start of the current growth period, 0 until the first ACK after a reduction
+	double k;                       //CUBIC: seconds after epoch at which the window is back at wmax
+	unsigned long losses;           //reductions by on_loss
+	unsigned long timeouts;         //reductions by on_timeout
+};
+
+// Return the hooks of congestion control algorithm algo, or NULL if there is no such algorithm.
+//
+const srt_cc_ops_t* srt_cc_get(int algo);
+
+// Return the algorithm named name (``reno'' or ``cubic''), or -1 if there is no such algorithm.
+//
+int srt_cc_find(const char* name);
+
+// Start cc over with the algorithm ops, full segments of mss bytes and a window of
+// CWND_INIT_SEGS of them.
+//
+void srt_cc_init(srt_cc_t* cc, const srt_cc_ops_t* ops, unsigned int mss);
+
+// Run the on_ack, on_loss or on_timeout hook of the algorithm, then keep the window between
+// one and CWND_MAX_SEGS full segments and update the counters.
+//
+void srt_cc_ack(srt_cc_t* cc, unsigned int acked, long long srtt, long long now);
+void srt_cc_loss(srt_cc_t* cc, unsigned int flight, long long now);
+void srt_cc_timeout(srt_cc_t* cc, unsigned int flight, long long now);
+
+#endif
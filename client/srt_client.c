@@ -8,14 +8,625 @@
 // Author: Victoria Taylor (function descriptions provided by Prof. Zhou)
 
 #include "srt_client.h"
+#include "../common/slab.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//number of chains in the demultiplexing hash, must be a power of 2
+#define TCB_HASH_SIZE 2048
 
 struct client_tcb *clientTCB[MAX_TRANSPORT_CONNECTIONS];
 int clientconn;
 
+// TCBs that have called srt_client_connect(), hashed by (client port, server port)
+static struct client_tcb *tcbHash[TCB_HASH_SIZE];
+
+// Protects clientTCB and tcbHash. It is taken before a TCB's bufMutex.
+static pthread_mutex_t tableMutex = PTHREAD_MUTEX_INITIALIZER;
+// Retransmission mode of new sockets, from SRT_ARQ or SRT_DEFAULT_ARQ
+static int arqMode = SRT_DEFAULT_ARQ;
+// Congestion control of new sockets, from SRT_CC or SRT_DEFAULT_CC
+static int ccAlgo = SRT_DEFAULT_CC;
+
+// Coalescing delay of new sockets, set by SRT_CORK
+static long long corkDelay = CORK_DELAY;
+// Segment size new sockets propose, from SRT_MSS or SRT_DEFAULT_MSS
+static unsigned int mssProposal = SRT_DEFAULT_MSS;
+
+// Segments from the server are received here; it has room for any the overlay carries
+static SEGBUF(JUMBO_SEG_LEN) rxSeg;
+
+// A TCB comes from tcbPool together with its mutex and condition. Its send buffer ring of
+// MAX_SEG_LEN segments comes from ringPool, a ring of another segment size from malloc()
+typedef struct client_tcb_obj {
+	struct client_tcb tcb;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} client_tcb_obj_t;
+static slab_pool_t *tcbPool;
+static slab_pool_t *ringPool;
+
+static unsigned int tcb_hashkey(unsigned int client_port, unsigned int svr_port)
+{
+	unsigned int h = client_port * 40503u + svr_port;
+	h *= 2654435761u;
+	return (h ^ (h >> 16)) & (TCB_HASH_SIZE - 1);
+}
+
+// Take the TCB out of the hash. Called with tableMutex held.
+static void tcb_unbind(struct client_tcb *tcb)
+{
+	struct client_tcb **p = &tcbHash[tcb_hashkey(tcb->client_portNum, tcb->svr_portNum)];
+	while (*p != NULL && *p != tcb){
+		p = &(*p)->hashNext;
+	}
+	if (*p != NULL){
+		*p = tcb->hashNext;
+	}
+	tcb->hashNext = NULL;
+}
+
+// Hash the TCB by its client port and the server port it connects to, instead of the server
+// port it was hashed by before, if any. Called with tableMutex held.
+static void tcb_bind(struct client_tcb *tcb, unsigned int svr_port)
+{
+	tcb_unbind(tcb);
+	tcb->svr_portNum = svr_port;
+	unsigned int h = tcb_hashkey(tcb->client_portNum, svr_port);
+	tcb->hashNext = tcbHash[h];
+	tcbHash[h] = tcb;
+}
+
+// Find the TCB a segment from the server belongs to. Called with tableMutex held.
+static struct client_tcb *tcb_lookup(seg_t *seg)
+{
+	struct client_tcb *tcb = tcbHash[tcb_hashkey(seg->header.dest_port, seg->header.src_port)];
+	for (; tcb != NULL; tcb = tcb->hashNext){
+		if (tcb->client_portNum == seg->header.dest_port && tcb->svr_portNum == seg->header.src_port){
+			return tcb;
+		}
+	}
+	return NULL;
+}
+
+// The send buffer ring slot a cursor names
+#define SENDBUF_SLOT(client, cursor) (&(client)->sendBuf[(cursor) & ((client)->sendBufSlots - 1)])
+// Cursor after the last segment that may be sent, short of the tail when the segment before it
+// is held back for more small writes
+#define SENDBUF_END(client) ((client)->sendBufTail - (client)->corked)
+// A full ring counts as writable again once a quarter of its slots and of its byte limit are
+// free, so a waiting sender refills a quarter of the ring at a time instead of waking for every ACK
+#define SENDBUF_WRITABLE(client) ((client)->sendBufTail - (client)->sendBufHead <= (client)->sendBufSlots - (client)->sendBufSlots / 4 \
+	&& (client)->sendBufBytes <= (client)->sendBufLimit - (client)->sendBufLimit / 4)
+
+// Number of slots of a send buffer ring of mss byte segments: the smallest power of 2 that
+// holds SEND_BUF_SIZE bytes, and at least CWND_INIT_SEGS
+static unsigned int sendBuf_slots(unsigned int mss)
+{
+	unsigned int slots = 1;
+	while (slots < CWND_INIT_SEGS || slots * mss < SEND_BUF_SIZE){
+		slots <<= 1;
+	}
+	return slots;
+}
+
+// Return the send buffer ring of the client to where it came from
+static void sendBuf_free(struct client_tcb *client)
+{
+	if (client->mss == MAX_SEG_LEN){
+		slab_free(ringPool, client->sendBuf);
+	}
+	else{
+		free(client->sendBuf);
+	}
+}
+
+// Give the client an empty send buffer ring of mss byte segments in place of its current one.
+// The slots are followed by the storage of their segments, laid out back to back.
+// The caller must hold the send buffer mutex once the TCB is in the table.
+// Returns 1 in case of success, and -1 if memory is exhausted; the client keeps its ring then.
+static int sendBuf_alloc(struct client_tcb *client, unsigned int mss)
+{
+	unsigned int slots = sendBuf_slots(mss);
+	segBuf_t *ring;
+	if (mss == MAX_SEG_LEN){
+		ring = slab_alloc(ringPool);
+	}
+	else{
+		ring = malloc(slots * (sizeof(segBuf_t) + SEG_SIZE(mss)));
+	}
+	if (ring == NULL){
+		return -1;
+	}
+	char *store = (char *)(ring + slots);
+	for (unsigned int i = 0; i < slots; i++){
+		ring[i].seg = (seg_t *)(store + i * SEG_SIZE(mss));
+	}
+	if (client->sendBuf != NULL){
+		sendBuf_free(client);
+	}
+	client->sendBuf = ring;
+	client->sendBufSlots = slots;
+	client->mss = mss;
+	if (client->sendBufLimit > slots * mss){
+		client->sendBufLimit = slots * mss;
+	}
+	return 1;
+}
+
+// Sequence number of the first byte of the segment a cursor names, or the next one to be
+// used for the tail; the bytes between two cursors are the difference of their sequence numbers
+static unsigned int sendBuf_seq(struct client_tcb *client, unsigned int cursor)
+{
+	if (cursor == client->sendBufTail){
+		return client->next_seqNum;
+	}
+	return SENDBUF_SLOT(client, cursor)->seg->header.seq_num;
+}
+
+// Data bytes in flight: sent, or about to be resent by Go-Back-N, and not ACKed
+static unsigned int sendBuf_flight(struct client_tcb *client)
+{
+	return sendBuf_seq(client, client->sendBufNext) - sendBuf_seq(client, client->sendBufHead);
+}
+
+// Recompute the retransmission timeout from the RTT estimate: srtt + 4 * rttvar, at least
+// RTO_MIN and a timer tick above srtt, or RTO_INIT before the first sample, doubled for every
+// timeout since the last sample up to RTO_MAX. The caller must hold the send buffer mutex.
+static void rtt_setrto(struct client_tcb *client)
+{
+	srt_rtt_t *rtt = &client->rtt;
+	long long rto = RTO_INIT;
+	if (rtt->samples > 0){
+		rto = rtt->srtt + (4 * rtt->rttvar > EVLOOP_TIMER_TICK ? 4 * rtt->rttvar : EVLOOP_TIMER_TICK);
+		if (rto < RTO_MIN){
+			rto = RTO_MIN;
+		}
+	}
+	for (int i = 0; i < rtt->backoff && rto < RTO_MAX; i++){
+		rto *= 2;
+	}
+	rtt->rto = rto < RTO_MAX ? rto : RTO_MAX;
+}
+
+// Add an RTT sample to the estimate as by Jacobson and Karels and clear the backoff.
+// The caller must hold the send buffer mutex.
+static void rtt_sample(struct client_tcb *client, long long sample)
+{
+	srt_rtt_t *rtt = &client->rtt;
+	if (rtt->samples++ == 0){
+		rtt->srtt = sample;
+		rtt->rttvar = sample / 2;
+	}
+	else{
+		long long err = sample - rtt->srtt;
+		rtt->rttvar += ((err < 0 ? -err : err) - rtt->rttvar) / 4;
+		rtt->srtt += err / 8;
+	}
+	rtt->backoff = 0;
+	rtt_setrto(client);
+}
+
+// Arm the retransmission timer for one retransmission timeout after the sent time of the
+// segment in flight that times out first, or disarm it when nothing is in flight. With Go-Back-N
+// that is the oldest segment in flight, or the last ACK of new data if that came later, so the
+// segments a Go-Back-N resend has not reached yet do not time out while ACKs keep coming; with
+// selective repeat every segment the server does not hold out of order has its own deadline,
+// and the timer follows the earliest of them. When nothing is in flight but data waits for the
+// server's receive window to open, the timer runs sendBuf_timer to probe the window instead,
+// one timeout later and twice as late for every probe already sent.
+// The caller must hold the send buffer mutex.
+static void sendBuf_rearm(struct client_tcb *client, long long now)
+{
+	long long sent = LLONG_MAX;
+
+	if (client->sendBufHead == client->sendBufNext && client->sendBufNext != SENDBUF_END(client)){
+		long long probe = client->rtt.rto;
+		for (int i = 0; i < client->probeBackoff && probe < RTO_MAX; i++){
+			probe *= 2;
+		}
+		evloop_timer_set(client->rtxTimer, probe < RTO_MAX ? probe : RTO_MAX);
+		return;
+	}
+	if (client->arq == SRT_ARQ_GBN){
+		if (client->sendBufHead != client->sendBufunSent){
+			sent = SENDBUF_SLOT(client, client->sendBufHead)->sentTime;
+			if (client->ackTime > sent){
+				sent = client->ackTime;
+			}
+		}
+	}
+	else{
+		for (unsigned int c = client->sendBufHead; c != client->sendBufunSent; c++){
+			if (!SENDBUF_SLOT(client, c)->sacked && SENDBUF_SLOT(client, c)->sentTime < sent){
+				sent = SENDBUF_SLOT(client, c)->sentTime;
+			}
+		}
+	}
+	if (sent == LLONG_MAX){
+		evloop_timer_set(client->rtxTimer, 0);
+		return;
+	}
+	long long left = sent + client->rtt.rto - now;
+	evloop_timer_set(client->rtxTimer, left > 0 ? left : 1);
+}
+
+// Send the segments of the cursors [first, last), at most CWND_MAX_SEGS of them, that the server
+// does not hold out of order and that were last sent before the time before, with a single
+// snp_sendseg_gather() call, and record their sent time. A segment that had been sent before
+// is marked retransmitted. The data of srt_client_sendv() segments is gathered from the
+// caller's buffers. The caller must hold the send buffer mutex and rearm the timer afterwards.
+// Returns the number of segments sent, and -1 in case of failure.
+static int sendBuf_xmit(struct client_tcb *client, unsigned int first, unsigned int last, long long before)
+{
+	seg_t *batch[CWND_MAX_SEGS];
+	const char *ext[CWND_MAX_SEGS];
+	segBuf_t *sent[CWND_MAX_SEGS];
+	int n = 0;
+
+	for (unsigned int c = first; c != last; c++){
+		segBuf_t *buffer = SENDBUF_SLOT(client, c);
+		if (buffer->sacked || buffer->sentTime >= before){
+			continue;
+		}
+		sent[n] = buffer;
+		batch[n] = buffer->seg;
+		ext[n++] = buffer->ext;
+	}
+	if (n == 0){
+		return 0;
+	}
+	if (snp_sendseg_gather(clientconn, batch, ext, n) < 0){
+		return -1;
+	}
+
+	// Record time of sent messages
+	long long sentTime = evloop_now();
+	for (int i = 0; i < n; i++){
+		sent[i]->retransmitted |= sent[i]->sentTime != 0;
+		sent[i]->sentTime = sentTime;
+	}
+	return n;
+}
+
+// Send the segments from sendBufNext on that fit in the congestion window and in the server's
+// receive window in one burst and rearm the retransmission timer. A segment held back for more
+// small writes is not sent. The caller must hold the send buffer mutex.
+// Returns 1 in case of success, and -1 in case of failure.
+static int sendBuf_flush(struct client_tcb *client)
+{
+	unsigned int last = client->sendBufNext;
+	unsigned int flight = sendBuf_flight(client);
+
+	while (last != SENDBUF_END(client) && last - client->sendBufHead < CWND_MAX_SEGS
+			&& flight + SENDBUF_SLOT(client, last)->seg->header.length <= client->cc.cwnd
+			&& SEQ_LEQ(sendBuf_seq(client, last) + SENDBUF_SLOT(client, last)->seg->header.length, client->sndEdge)){
+		flight += SENDBUF_SLOT(client, last)->seg->header.length;
+		last++;
+	}
+	if (sendBuf_xmit(client, client->sendBufNext, last, LLONG_MAX) < 0){
+		return -1;
+	}
+	client->sendBufNext = last;
+	if (last - client->sendBufHead > client->sendBufunSent - client->sendBufHead){
+		client->sendBufunSent = last;
+	}
+	sendBuf_rearm(client, evloop_now());
+	return 1;
+}
+
+// Stop holding back the segment at the tail for more small writes: compute its checksum over
+// the data coalesced into it and cancel the cork timer. The caller must hold the send buffer
+// mutex and call sendBuf_flush() to send it.
+static void sendBuf_seal(struct client_tcb *client)
+{
+	if (!client->corked){
+		return;
+	}
+	segBuf_t *held = SENDBUF_SLOT(client, client->sendBufTail - 1);
+	held->seg->header.checksum = checksum(held->seg);
+	client->corked = 0;
+	evloop_timer_set(client->corkTimer, 0);
+}
+
+// Send a zero length DATA segment at the next sequence number to send, so the server answers
+// with a DATAACK advertising its current receive window. The caller must hold the send buffer mutex.
+static void sendBuf_probe(struct client_tcb *client)
+{
+	SEGBUF(0) buf;
+	seg_t *seg = &buf.seg;
+	memset(&seg->header, 0, sizeof(srt_hdr_t));
+	seg->header.src_port = client->client_portNum;
+	seg->header.dest_port = client->svr_portNum;
+	seg->header.type = DATA;
+	seg->header.seq_num = sendBuf_seq(client, client->sendBufNext);
+	snp_sendseg(clientconn, seg);
+	printf("%d: Window probe sent\n", client->sockfd);
+}
+
+// Segment size the SYN of the client proposes: the socket's, lowered to what the overlay carries
+static unsigned int sendBuf_synmss(struct client_tcb *client)
+{
+	int maxseg = snp_getmaxseg(clientconn);
+	if (maxseg > 0 && (unsigned int)maxseg < client->wantMss){
+		return maxseg;
+	}
+	return client->wantMss;
+}
+
+// Send the SYN or FIN of the SYNSENT or FINWAIT state and arm the retransmission timer for
+// SYN_TIMEOUT or FIN_TIMEOUT. The SYN proposes a segment size in its data.
+// The caller must hold the send buffer mutex.
+static void sendBuf_ctl(struct client_tcb *client)
+{
+	SEGBUF(sizeof(srt_synopt_t)) buf;
+	seg_t *seg = &buf.seg;
+	memset(&seg->header, 0, sizeof(srt_hdr_t));
+	seg->header.src_port = client->client_portNum;
+	seg->header.dest_port = client->svr_portNum;
+	client->ctlSentTime = evloop_now();
+	if (client->state == SYNSENT){
+		srt_synopt_t opt = { sendBuf_synmss(client) };
+		seg->header.type = SYN;
+		seg->header.seq_num = 0;
+		seg->header.length = sizeof(srt_synopt_t);
+		memcpy(seg->data, &opt, sizeof(srt_synopt_t));
+		snp_sendseg(clientconn, seg);
+		printf("%d: SYN sent\n", client->sockfd);
+		evloop_timer_set(client->rtxTimer, SYN_TIMEOUT);
+	}
+	else{
+		seg->header.type = FIN;
+		seg->header.seq_num = client->next_seqNum;
+		snp_sendseg(clientconn, seg);
+		printf("%d: FIN sent\n", client->sockfd);
+		evloop_timer_set(client->rtxTimer, FIN_TIMEOUT);
+	}
+}
+
+// Free the slots of the segments a DATAACK for ACKseg covers. The acknowledged segments
+// are a prefix of the in-flight cursors [sendBufHead, sendBufunSent) and their sequence
+// numbers increase with the cursor in serial number order, so the new head is found by binary search.
+// The srt_client_sendv() completions of the freed slots are stored in done and ctx, which
+// have room for CWND_MAX_SEGS, the most segments in flight, and counted in *ndone. The newest
+// segment acknowledged gives an RTT sample unless one of them was retransmitted, and the
+// congestion control is told how many bytes were ACKed. The caller must hold the send buffer
+// mutex and rearm the retransmission timer afterwards.
+// Returns the number of slots freed.
+static unsigned int sendBuf_ack(struct client_tcb *client, unsigned int ACKseg, srt_sendv_cb *done, void **ctx, int *ndone)
+{
+	unsigned int lo = client->sendBufHead;
+	unsigned int hi = client->sendBufunSent;
+
+	while (lo != hi){
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (SEQ_LT(SENDBUF_SLOT(client, mid)->seg->header.seq_num, ACKseg)){
+			lo = mid + 1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+	unsigned int freed = lo - client->sendBufHead;
+	unsigned int acked = 0;
+	int retransmitted = 0;
+	for (unsigned int c = client->sendBufHead; c != lo; c++){
+		acked += SENDBUF_SLOT(client, c)->seg->header.length;
+		retransmitted |= SENDBUF_SLOT(client, c)->retransmitted;
+		if (SENDBUF_SLOT(client, c)->done != NULL){
+			done[*ndone] = SENDBUF_SLOT(client, c)->done;
+			ctx[(*ndone)++] = SENDBUF_SLOT(client, c)->ctx;
+		}
+	}
+	if (freed == 0){
+		return 0;
+	}
+
+	//A Go-Back-N resend that the ACK overtook continues after it
+	if (client->sendBufNext - client->sendBufHead < freed){
+		client->sendBufNext = lo;
+	}
+	client->sendBufHead = lo;
+	client->sendBufBytes -= acked;
+	client->ackOffset += acked;
+	client->ackTime = evloop_now();
+	if (!retransmitted){
+		rtt_sample(client, client->ackTime - SENDBUF_SLOT(client, lo - 1)->sentTime);
+	}
+	srt_cc_ack(&client->cc, acked, client->rtt.srtt, client->ackTime);
+	return freed;
+}
+
+// Mark the segments in flight that the selective ACK blocks of a DATAACK cover, so that they
+// are not sent again. The blocks and the segments in flight are both in sequence order, which
+// is compared by the offset from the oldest segment in flight.
+// The caller must hold the send buffer mutex.
+static void sendBuf_sack(struct client_tcb *client, const srt_sack_t *sack, int n)
+{
+	unsigned int c = client->sendBufHead;
+	if (c == client->sendBufunSent){
+		return;
+	}
+	unsigned int base = SENDBUF_SLOT(client, c)->seg->header.seq_num;
+
+	for (int i = 0; i < n; i++){
+		unsigned int start = sack[i].start - base;
+		unsigned int end = sack[i].end - base;
+		if (start > end){
+			continue;
+		}
+		while (c != client->sendBufunSent && SENDBUF_SLOT(client, c)->seg->header.seq_num - base < start){
+			c++;
+		}
+		while (c != client->sendBufunSent && SENDBUF_SLOT(client, c)->seg->header.seq_num - base + SENDBUF_SLOT(client, c)->seg->header.length <= end){
+			SENDBUF_SLOT(client, c)->sacked = 1;
+			c++;
+		}
+	}
+}
+
+// Queue the bytes of the iovec array at the tail of the send buffer ring and send what the
+// window allows. When the next segment does not fit in the ring's slots or byte limit it sends
+// what the window allows, then either waits for ACKs to free a quarter of the ring or, on a
+// nonblocking socket, stops there. With copy set the data is copied into the segments,
+// otherwise the segments point into the caller's buffers and do not span iovecs. Copied data is
+// first appended to a segment held back for more small writes, and on a corking socket a
+// copied segment shorter than the segment size is held back in turn. done(ctx),
+// if given, is attached to the last segment queued while it is still in the ring, and
+// *attached tells whether it was; if not, nothing of this call is left in the ring.
+// The caller must hold the send buffer mutex.
+// Returns the number of bytes queued, and -1 if sending fails or the connection leaves CONNECTED.
+static long sendBuf_append(struct client_tcb *client, const struct iovec *iov, int iovcnt, int copy, srt_sendv_cb done, void *ctx, int *attached)
+{
+	const char *data = NULL;
+	size_t length = 0;
+	unsigned int last = 0;
+	long queued = 0;
+	int chunk;
+	int r = 1;
+
+	while (length > 0 || iovcnt > 0){
+		if (length == 0){
+			data = iov->iov_base;
+			length = iov->iov_len;
+			iov++;
+			iovcnt--;
+			continue;
+		}
+
+		//Fill up the segment held back for small writes first, and send it on once it is
+		//full or the data can not go into it
+		if (client->corked){
+			struct segBuf *held = SENDBUF_SLOT(client, client->sendBufTail - 1);
+			chunk = client->mss - held->seg->header.length;
+			if ((size_t)chunk > length){
+				chunk = length;
+			}
+			if (copy && client->sendBufBytes + chunk <= client->sendBufLimit){
+				memcpy(held->seg->data + held->seg->header.length, data, chunk);
+				held->seg->header.length += chunk;
+				data += chunk;
+				length -= chunk;
+				queued += chunk;
+				client->sendBufBytes += chunk;
+				client->next_seqNum += chunk;
+				client->sndOffset += chunk;
+				last = client->sendBufTail - 1;
+			}
+			if (held->seg->header.length == client->mss || length > 0){
+				sendBuf_seal(client);
+			}
+			continue;
+		}
+
+		//Segment size is the min of the negotiated segment size and data
+		if (length > client->mss){
+			chunk = client->mss;
+		}
+		else{
+			chunk = length;
+		}
+
+		//The ring is full when it has no free slot or the segment would exceed its byte limit
+		if (client->sendBufTail - client->sendBufHead == client->sendBufSlots || client->sendBufBytes + chunk > client->sendBufLimit){
+			if (sendBuf_flush(client) < 0){
+				r = -1;
+				break;
+			}
+			if (client->nonblock){
+				client->wantWritable = 1;
+				break;
+			}
+			while (r > 0 && (!SENDBUF_WRITABLE(client) || client->sendBufTail - client->sendBufHead == client->sendBufSlots
+					|| client->sendBufBytes + chunk > client->sendBufLimit)){
+				if (client->state != CONNECTED){
+					r = -1;
+				}
+				else{
+					pthread_cond_wait(client->bufCond, client->bufMutex);
+				}
+			}
+			if (r < 0){
+				break;
+			}
+		}
+
+		//Fill the slot at the tail
+		struct segBuf *buffer = SENDBUF_SLOT(client, client->sendBufTail);
+		buffer->seg->header.src_port = client->client_portNum;
+		buffer->seg->header.dest_port = client->svr_portNum;
+		buffer->seg->header.seq_num = client->next_seqNum;
+		buffer->seg->header.ack_num = 0;
+		buffer->seg->header.length = chunk;
+		buffer->seg->header.type = DATA;
+		buffer->seg->header.rcv_win = 0;
+		buffer->seg->header.checksum = 0;
+		buffer->sentTime = 0;
+		buffer->retransmitted = 0;
+		buffer->sacked = 0;
+		buffer->done = NULL;
+
+		//Copy data into the sendBuf, or point at it, computing the checksum in the same pass
+		unsigned long long sum;
+		if (copy){
+			sum = checksum_copy(buffer->seg->data, data, chunk, 0);
+			buffer->ext = NULL;
+		}
+		else{
+			sum = checksum_partial(data, chunk, 0);
+			buffer->ext = data;
+		}
+		sum = checksum_partial(&buffer->seg->header, sizeof(srt_hdr_t), sum);
+		buffer->seg->header.checksum = ~checksum_fold(sum);
+		data += chunk;
+		length -= chunk;
+		queued += chunk;
+		client->sendBufBytes += chunk;
+
+		//Update next_seqNum
+		client->next_seqNum += chunk;
+		client->sndOffset += chunk;
+		last = client->sendBufTail++;
+
+		//On a corking socket a short segment waits for more writes, until the cork timer
+		if (copy && client->corkDelay > 0 && chunk < (int)client->mss){
+			client->corked = 1;
+			evloop_timer_set(client->corkTimer, client->corkDelay);
+		}
+	}
+
+	//Unless waiting for room failed, the mutex has been held since the last segment was queued,
+	//so it cannot have been ACKed
+	*attached = queued > 0 && last - client->sendBufHead < client->sendBufTail - client->sendBufHead;
+	if (*attached){
+		SENDBUF_SLOT(client, last)->done = done;
+		SENDBUF_SLOT(client, last)->ctx = ctx;
+	}
+
+	//Send what the window allows
+	if (r < 0 || sendBuf_flush(client) < 0){
+		return -1;
+	}
+	return queued;
+}
+
+// Result of a send on a nonblocking socket that queued queued of length bytes: the number
+// of bytes queued, or -1 with errno set to EAGAIN when there was data but none of it fit
+static int sendBuf_accepted(long queued, size_t length)
+{
+	if (queued == 0 && length > 0){
+		errno = EAGAIN;
+		return -1;
+	}
+	return queued;
+}
+
 //
 //
 //  SRT socket API for the client side application. 
@@ -35,9 +646,9 @@ int clientconn;
 
 // This function initializes the TCB table marking all entries NULL. It also initializes 
 // a global variable for the overlay TCP socket descriptor ``conn'' used as input parameter
-// for snp_sendseg and snp_recvseg. Finally, the function starts the seghandler thread to 
-// handle the incoming segments. There is only one seghandler for the client side which
-// handles call connections for the client.
+// for snp_sendseg and snp_recvseg. Finally, the function starts the event loop and registers
+// seghandler to handle the incoming segments whenever the overlay is readable. There is only
+// one seghandler for the client side which handles call connections for the client.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -50,13 +661,64 @@ void srt_client_init(int conn)
 
 	// Initialize global variable for TCP connection
 	clientconn = conn;
+
+	// SRT_CC=reno or cubic picks the congestion control of new sockets
+	char* cc = getenv("SRT_CC");
+	if (cc != NULL){
+		if (srt_cc_find(cc) >= 0){
+			ccAlgo = srt_cc_find(cc);
+		}
+		else{
+			printf("SRT_CC: unknown congestion control %s, using the default\n", cc);
+		}
+	}
+
+	// SRT_CORK=microseconds makes new sockets coalesce small writes for that long
+	char* cork = getenv("SRT_CORK");
+	if (cork != NULL){
+		corkDelay = atoll(cork) * 1000;
+	}
+
+	// SRT_ARQ=gbn or sr picks the retransmission mode of new sockets
+	char* arq = getenv("SRT_ARQ");
+	if (arq != NULL){
+		if (strcmp(arq, "gbn") == 0){
+			arqMode = SRT_ARQ_GBN;
+		}
+		else if (strcmp(arq, "sr") == 0){
+			arqMode = SRT_ARQ_SR;
+		}
+		else{
+			printf("SRT_ARQ: unknown mode %s, using the default\n", arq);
+		}
+	}
+
+	// SRT_MSS=bytes sets the segment size new sockets propose
+	char* mss = getenv("SRT_MSS");
+	if (mss != NULL){
+		if (atoi(mss) >= MAX_SEG_LEN && atoi(mss) <= JUMBO_SEG_LEN){
+			mssProposal = atoi(mss);
+		}
+		else{
+			printf("SRT_MSS: segment size %s out of range, using the default\n", mss);
+		}
+	}
+
+	// Create the TCB pool, and the pool of send buffer rings of MAX_SEG_LEN segments sized
+	// from the byte budget
+	if (tcbPool == NULL){
+		unsigned int slots = sendBuf_slots(MAX_SEG_LEN);
+		tcbPool = slab_create("client tcb", sizeof(client_tcb_obj_t), TCB_PER_SLAB);
+		ringPool = slab_create("client send buffer", slots * (sizeof(segBuf_t) + SEG_SIZE(MAX_SEG_LEN)), 1);
+		if (tcbPool == NULL || ringPool == NULL){
+			printf("Problem creating the slab pools\n");
+			exit(1);
+		}
+	}
 	
-	//start seghandler
-	int err; 
-	pthread_t newthread;
-	err = pthread_create(&newthread, NULL, seghandler, NULL);
-	if (err != 0){
-		printf("Problem creating thread\n");
+	//start the event loop and hand it the overlay
+	if (evloop_start() < 0 || evloop_add_fd(snp_getpollfd(conn), seghandler, NULL) < 0){
+		printf("Problem starting the event loop\n");
 		exit(1);
 	}
 	return;
@@ -64,7 +726,7 @@ void srt_client_init(int conn)
 
 
 // This function looks up the client TCB table to find the first NULL entry, and creates
-// a new TCB entry using malloc() for that entry. All fields in the TCB are initialized 
+// a new TCB entry taken from the TCB pool for that entry. All fields in the TCB are initialized 
 // e.g., TCB state is set to CLOSED and the client port set to the function call parameter 
 // client port.  The TCB table entry index should be returned as the new socket ID to the client 
 // and be used to identify the connection on the client side. If no entry in the TC table  
@@ -76,24 +738,75 @@ int srt_client_sock(unsigned int client_port)
 {
 
   	// Find first NULL entry in TCB table and fill it with new client_tcb
+	pthread_mutex_lock(&tableMutex);
 	for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
 		if (clientTCB[i] == NULL){
-			struct client_tcb *newClient = malloc(sizeof(struct client_tcb));
+			client_tcb_obj_t *obj = slab_alloc(tcbPool);
+			if (obj == NULL){
+				pthread_mutex_unlock(&tableMutex);
+				printf("TCB allocation failed\n");
+				return -1;
+			}
+			struct client_tcb *newClient = &obj->tcb;
 			newClient->client_portNum = client_port;
 			newClient->state = CLOSED;
-			newClient->sendBufHead = NULL;
-			newClient->sendBufTail = NULL;
+			newClient->sockfd = i;
+			newClient->arq = arqMode;
+			newClient->dupAcks = 0;
+			newClient->dupThresh = DUPACK_THRESH;
+			newClient->ctlTimeouts = 0;
+			memset(&newClient->rtt, 0, sizeof(srt_rtt_t));
+			rtt_setrto(newClient);
+			newClient->sendBufHead = 0;
+			newClient->sendBufNext = 0;
+			newClient->sendBufunSent = 0;
+			newClient->ackTime = 0;
+			newClient->sndEdge = 0;
+			newClient->sndOffset = 0;
+			newClient->ackOffset = 0;
+			newClient->probeBackoff = 0;
+			srt_cc_init(&newClient->cc, srt_cc_get(ccAlgo), MAX_SEG_LEN);
+			newClient->sendBufTail = 0;
+			newClient->sendBufBytes = 0;
+			newClient->sendBufLimit = SEND_BUF_SIZE;
+			newClient->nonblock = 0;
+			newClient->wantWritable = 0;
+			newClient->writable = NULL;
+			newClient->writableCtx = NULL;
+			newClient->corkDelay = corkDelay;
+			newClient->corked = 0;
+			newClient->wantMss = mssProposal;
+			newClient->hashNext = NULL;
 			clientTCB[i] = newClient;
+			pthread_mutex_unlock(&tableMutex);
+
+			newClient->sendBuf = NULL;
+			newClient->mss = MAX_SEG_LEN;
+			if (sendBuf_alloc(newClient, MAX_SEG_LEN) < 0){
+				printf("send buffer allocation failed\n");
+				return -1;
+			}
 
 
 			// Creat mutex for client's send buffer
-			pthread_mutex_t *mutex;
-			mutex = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
-			if (pthread_mutex_init(mutex, NULL) != 0 ){
+			if (pthread_mutex_init(&obj->mutex, NULL) != 0 ){
 				printf("mutex init failed\n");
 				return -1;
 			}
-			newClient->bufMutex = mutex;
+			newClient->bufMutex = &obj->mutex;
+
+			// Condition the blocking calls wait on, and the retransmission timer
+			newClient->bufCond = &obj->cond;
+			if (evloop_cond_init(newClient->bufCond) < 0){
+				printf("cond init failed\n");
+				return -1;
+			}
+			newClient->rtxTimer = evloop_timer_new(sendBuf_timer, newClient);
+			newClient->corkTimer = evloop_timer_new(sendBuf_corktimer, newClient);
+			if (newClient->rtxTimer == NULL || newClient->corkTimer == NULL){
+				printf("timer init failed\n");
+				return -1;
+			}
 
 			// return sockID (table index)
 			return i;
@@ -101,6 +814,7 @@ int srt_client_sock(unsigned int client_port)
 	}
 
 	// No more room in TCB table
+	pthread_mutex_unlock(&tableMutex);
 	return -1;
 }
 
@@ -112,150 +826,460 @@ int srt_client_sock(unsigned int client_port)
 // If no SYNACK is received after SYNSEG_TIMEOUT timeout, then the SYN is 
 // retransmitted. If SYNACK is received, return 1. Otherwise, if the number of SYNs 
 // sent > SYN_MAX_RETRY,  transition to CLOSED state and return -1.
+// The SYN is retransmitted by sendBuf_timer. The call waits on the TCB's condition, which
+// seghandler signals on the SYNACK and sendBuf_timer once the last SYN has timed out.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 int srt_client_connect(int sockfd, unsigned int server_port)
 {
 	struct client_tcb *client = clientTCB[sockfd];
-	client->svr_portNum = server_port;
-
-	//Set up the timespec
-	struct timespec *req = malloc(sizeof(struct timespec));
-	req->tv_nsec = SYN_TIMEOUT;
-
-	//Set up segment
-	seg_t synseg; 
-	synseg.header.src_port = client->client_portNum;
-	synseg.header.dest_port = client->svr_portNum;
-	synseg.header.length = 0;
-	synseg.header.type = SYN;
-	synseg.header.seq_num = 0;
+	pthread_mutex_lock(&tableMutex);
+	tcb_bind(client, server_port);
+	pthread_mutex_unlock(&tableMutex);
 
 	//Check state of connection
+	pthread_mutex_lock(client->bufMutex);
 	if (client->state == CLOSED){		//can't connect unless closed
 		
-		//Send SYN up to SYN_MAX_RETRY times
-		for (int synNum = 0; synNum < SYN_MAX_RETRY; synNum++){
-			//Send SYN and transition to SYNSENT
-			snp_sendseg(clientconn, &synseg);
-			client->state = SYNSENT;
-			client->next_seqNum = 1;
-			printf("%d: SYN sent\n", sockfd);
-
-			//set timer
-			nanosleep(req, NULL);
-
-			//Check if connection  established:
-			if (client->state == CONNECTED){
-				printf("%d: Connected\n", sockfd);
-				free(req);
-
-				return 1;
-			}
+		//Transition to SYNSENT and send SYN. The state changes first so
+		//a fast SYNACK is not handled in the CLOSED state.
+		client->state = SYNSENT;
+		client->next_seqNum = 1;
+		client->sndOffset = 0;
+		client->ackOffset = 0;
+		client->ctlTimeouts = 0;
+		memset(&client->rtt, 0, sizeof(srt_rtt_t));
+		rtt_setrto(client);
+		sendBuf_ctl(client);
+
+		//Wait for the SYNACK while sendBuf_timer sends the SYN up to SYN_MAX_RETRY times
+		while (client->state == SYNSENT && client->ctlTimeouts < SYN_MAX_RETRY){
+			pthread_cond_wait(client->bufCond, client->bufMutex);
 		}
-		// Too many connection attempts
-		if (client->state == SYNSENT){
-			client->state = CLOSED;
-			printf("%d: Too many connect attempts\n", sockfd);
-			free(req);
-			return -1;
+
+		//Check if connection  established:
+		if (client->state == CONNECTED){
+			printf("%d: Connected\n", sockfd);
+			pthread_mutex_unlock(client->bufMutex);
+			return 1;
 		}
+		// Too many connection attempts
+		client->state = CLOSED;
+		printf("%d: Too many connect attempts\n", sockfd);
+		pthread_mutex_unlock(client->bufMutex);
+		return -1;
 	}
 	else {
 		printf("%d: Connection must be closed to connect\n", sockfd);
-		free(req);
+		pthread_mutex_unlock(client->bufMutex);
 		return -1;
 	}
 }
 
 
-// Send data to a srt server. This function should use the socket ID to find the TCP entry. 
-// Then It should create segBufs using the given data and append them to send buffer linked list. 
-// If the send buffer was empty before insertion, a thread called sendbuf_timer 
-// should be started to poll the send buffer every SENDBUF_POLLING_INTERVAL time
-// to check if a timeout event should occur. If the function completes successfully, 
-// it returns 1. Otherwise, it returns -1.
-// 
+// Send data to a srt server. This function should use the SRT socket ID to find the TCP entry. 
+// It copies exactly length bytes of data into segBufs at the tail of the send buffer ring;
+// the data may hold any bytes, including NULs.
+// Whenever the oldest segment in flight is sent, the TCB's retransmission timer is armed
+// to run sendBuf_timer one retransmission timeout later, see srt_client_getrtt(). If the function completes successfully, 
+// it returns 1. Otherwise, it returns -1. srt_client_send only blocks while the ring is
+// full, in slots or in bytes (see srt_client_setsndbuf()), until ACKs free enough of it for
+// the rest of the data; it returns -1 if the connection leaves CONNECTED meanwhile. On a
+// nonblocking socket it returns the number of bytes queued instead, see srt_client_setnonblock().
+// Because user data is fragmented into fixed sized SRT segments there may be
+// multiple segBufs queued to the send buffer ring for a single srt_client_send call.
+// If the call is successful the data is queued on the TCB send buffer ring and
+// depending on the condition of the sliding window the data will either be
+// transmitted over the network or queued waiting to be transmitted. 
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 int srt_client_send(int sockfd, void* data, unsigned int length)
 {
 	struct client_tcb *client = clientTCB[sockfd];
-	length = strlen(data);
-	int copy;
+	struct iovec iov = { data, length };
+	int attached;
 
+	//Copy the data into segBufs and send what the window allows
 	pthread_mutex_lock(client->bufMutex);
-	while (length){
-		
-		//Copy size is the min of MAX_SEG_LEN and data
-		if (length > MAX_SEG_LEN){
-			copy = MAX_SEG_LEN;
-		}
-		else{
-			copy = length;
-		}
+	long queued = sendBuf_append(client, &iov, 1, 1, NULL, NULL, &attached);
+	int nonblock = client->nonblock;
+	pthread_mutex_unlock(client->bufMutex);
+	if (queued < 0){
+		printf("%d: send failed", sockfd);
+		return -1;
+	}
+	if (nonblock){
+		return sendBuf_accepted(queued, length);
+	}
+	return 1;
+}
+
 
-		//Allocate sendBuf
-		struct segBuf *buffer = malloc(sizeof(struct segBuf));
-		buffer->seg.header.src_port = client->client_portNum;
-		buffer->seg.header.dest_port = client->svr_portNum;
-		buffer->seg.header.seq_num = client->next_seqNum;
-		buffer->seg.header.length = copy;
-		buffer->seg.header.type = DATA;
+// Send the data of the iovec array without copying it. The segBufs appended to the send
+// buffer ring point into the caller's buffers, and done(ctx) is attached to the last of
+// them, so seghandler calls it once that segment has been ACKed. See srt_client.h.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_sendv(int sockfd, const struct iovec* iov, int iovcnt, srt_sendv_cb done, void* ctx)
+{
+	struct client_tcb *client = clientTCB[sockfd];
+	size_t length = 0;
 
-		//Copy data into the sendBuf
-		memcpy(buffer->seg.data, data, copy);
-		data += copy;
-		length -= copy;
+	for (int i = 0; i < iovcnt; i++){
+		length += iov[i].iov_len;
+	}
+	int attached;
+	pthread_mutex_lock(client->bufMutex);
+	long queued = sendBuf_append(client, iov, iovcnt, 0, done, ctx, &attached);
+	int nonblock = client->nonblock;
+	pthread_mutex_unlock(client->bufMutex);
 
-		//Update next_seqNum
-		client->next_seqNum += copy;
-
-		//If send buffer is empty, start timer thread
-		if (client->sendBufHead == NULL){
-			pthread_t timethread;
-			pthread_create(&timethread, NULL, sendBuf_timer, client); //need to pass in client data here 
-			
-			//All three sendBuf pointers to first buffer
-			client->sendBufHead = buffer;
-			client->sendBufunSent = buffer;
-			client->sendBufTail = buffer;
-	
+	//Unless the data was refused with EAGAIN, done is due now if no segment of it is left to be ACKed
+	if (!attached && done != NULL && !(queued == 0 && length > 0)){
+		done(ctx);
+	}
+	if (queued < 0){
+		printf("%d: send failed", sockfd);
+		return -1;
+	}
+	if (nonblock){
+		return sendBuf_accepted(queued, length);
+	}
+	return 1;
+}
+
+
+// Unmap a srt_client_sendfile() window once every segment pointing into it has been ACKed
+static void sendfile_unmap(void* window)
+{
+	munmap(window, SENDFILE_WINDOW);
+}
+
+// Send count bytes of the file fd from offset on. The file is mapped SENDFILE_WINDOW bytes at a
+// time and the segBufs of each window point into the mapping, which sendfile_unmap releases
+// once they have all been ACKed. A window is only mapped once the ring has taken all of the
+// one before, so the file is segmented as fast as ACKs open the window. A file that
+// cannot be mapped is read with pread() into a buffer whose bytes are copied into the segBufs,
+// and a descriptor that cannot seek (pipes, sockets) with read() from its current position; on
+// a nonblocking socket no more is read than the send buffer takes, as read bytes can not be put back.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+long srt_client_sendfile(int sockfd, int fd, off_t offset, size_t count)
+{
+	struct client_tcb *client = clientTCB[sockfd];
+	long pagesize = sysconf(_SC_PAGESIZE);
+	struct stat st;
+	size_t sent = 0;
+	int attached;
+	int stream;
+	int eof = 0;
+
+	//Do not send past the end of a regular file, a mapping has no pages there
+	if (fstat(fd, &st) < 0){
+		return -1;
+	}
+	if (S_ISREG(st.st_mode)){
+		if (offset >= st.st_size){
+			count = 0;
+		}
+		else if ((off_t)count > st.st_size - offset){
+			count = st.st_size - offset;
+		}
+	}
+	stream = !S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) < 0 && errno == ESPIPE;
+
+	while (sent < count){
+		off_t pos = offset + sent;
+		off_t base = pos & ~(off_t)(pagesize - 1);
+		size_t length = SENDFILE_WINDOW - (pos - base);
+		if (length > count - sent){
+			length = count - sent;
 		}
 
-		//Send buffer isn't empty- append buffer
+		long queued;
+		char *window = stream ? MAP_FAILED : mmap(NULL, SENDFILE_WINDOW, PROT_READ, MAP_SHARED, fd, base);
+		if (window != MAP_FAILED){
+			madvise(window, SENDFILE_WINDOW, MADV_SEQUENTIAL);
+			struct iovec iov = { window + (pos - base), length };
+			pthread_mutex_lock(client->bufMutex);
+			queued = sendBuf_append(client, &iov, 1, 0, sendfile_unmap, window, &attached);
+			pthread_mutex_unlock(client->bufMutex);
+			if (!attached){
+				munmap(window, SENDFILE_WINDOW);
+			}
+		}
 		else{
-			client->sendBufTail->next = buffer;
-			client->sendBufTail = buffer;
-			client->sendBufTail->next = NULL;
-			if (client->sendBufunSent == NULL){
-				client->sendBufunSent = buffer;
+			char buf[SENDFILE_PREAD];
+			if (length > sizeof(buf)){
+				length = sizeof(buf);
+			}
+			if (stream && client->nonblock){
+				pthread_mutex_lock(client->bufMutex);
+				size_t room = (size_t)(client->sendBufSlots - (client->sendBufTail - client->sendBufHead)) * client->mss;
+				if (client->sendBufBytes >= client->sendBufLimit){
+					room = 0;
+				}
+				else if (room > client->sendBufLimit - client->sendBufBytes){
+					room = client->sendBufLimit - client->sendBufBytes;
+				}
+				if (room == 0){
+					client->wantWritable = 1;
+				}
+				pthread_mutex_unlock(client->bufMutex);
+				if (room == 0){
+					break;
+				}
+				if (length > room){
+					length = room;
+				}
+			}
+			ssize_t n = stream ? read(fd, buf, length) : pread(fd, buf, length, pos);
+			if (n < 0){
+				//Report the error unless some data is queued already, then the next call does
+				if (sent == 0){
+					return -1;
+				}
+				break;
+			}
+			if (n == 0){
+				eof = 1;
+				break;
 			}
+			length = n;
+			struct iovec iov = { buf, length };
+			pthread_mutex_lock(client->bufMutex);
+			queued = sendBuf_append(client, &iov, 1, 1, NULL, NULL, &attached);
+			pthread_mutex_unlock(client->bufMutex);
+		}
+		if (queued < 0){
+			printf("%d: send failed", sockfd);
+			return -1;
 		}
+		sent += queued;
 
+		//Only a nonblocking socket queues less than asked
+		if ((size_t)queued < length){
+			break;
+		}
+	}
+	if (sent == 0 && count > 0 && !eof && client->nonblock){
+		errno = EAGAIN;
+		return -1;
 	}
+	return sent;
+}
 
-	//All segBufs are created- now send them 
-	while ((client->unAck_segNum < GBN_WINDOW) && (client->sendBufunSent != NULL)){
 
-			if (snp_sendseg(clientconn, &client->sendBufunSent->seg)){
-				
-				// Record time of sent message
-				struct timeval curr;
-				gettimeofday(&curr, NULL);
-				client->sendBufunSent->sentTime = (1000000 * curr.tv_sec) + curr.tv_usec;
+// Set the byte limit of the socket's send buffer, clamped between one full segment and what
+// the ring holds. A lower limit takes effect for the next segment queued.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setsndbuf(int sockfd, unsigned int bytes)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	if (bytes < client->mss){
+		bytes = client->mss;
+	}
+	if (bytes > client->sendBufSlots * client->mss){
+		bytes = client->sendBufSlots * client->mss;
+	}
+	client->sendBufLimit = bytes;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
 
-				client->sendBufunSent = client->sendBufunSent->next;
-				client->unAck_segNum++;
-			}
-			else{
-				printf("%d: send failed", sockfd);
-				pthread_mutex_unlock(client->bufMutex);
-				return -1;
-			}
+
+// Copy the RTT estimate of the socket.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_getrtt(int sockfd, srt_rtt_t* rtt)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	*rtt = client->rtt;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Copy the 64-bit stream offsets of the socket.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_getoffsets(int sockfd, unsigned long long* queued, unsigned long long* acked)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL || queued == NULL || acked == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	*queued = client->sndOffset;
+	*acked = client->ackOffset;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Pick the congestion control algorithm of the socket.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setcc(int sockfd, int algo)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL || srt_cc_get(algo) == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	srt_cc_init(&client->cc, srt_cc_get(algo), client->mss);
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Copy the congestion control state of the socket.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_getcc(int sockfd, srt_cc_t* cc)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	*cc = client->cc;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Set the duplicate ACK threshold of fast retransmit.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setdupthresh(int sockfd, unsigned int dupacks)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	client->dupThresh = dupacks;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Set the coalescing delay of small writes.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setcork(int sockfd, long long delay)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL || delay < 0){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	int r = 1;
+	pthread_mutex_lock(client->bufMutex);
+	client->corkDelay = delay;
+	if (delay == 0 && client->corked){
+		sendBuf_seal(client);
+		r = sendBuf_flush(client);
+	}
+	pthread_mutex_unlock(client->bufMutex);
+	return r;
+}
+
+
+// Send the segment held back for more small writes now.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_flush(int sockfd)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	int r = 1;
+	pthread_mutex_lock(client->bufMutex);
+	if (client->corked){
+		sendBuf_seal(client);
+		r = sendBuf_flush(client);
+	}
+	pthread_mutex_unlock(client->bufMutex);
+	return r;
+}
+
+
+// Set the segment size the socket proposes in its SYN.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setmss(int sockfd, unsigned int mss)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL
+			|| mss < MAX_SEG_LEN || mss > JUMBO_SEG_LEN){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	int r = -1;
+	pthread_mutex_lock(client->bufMutex);
+	if (client->state == CLOSED){
+		client->wantMss = mss;
+		r = 1;
+	}
+	pthread_mutex_unlock(client->bufMutex);
+	return r;
+}
+
+
+// Switch the socket between blocking and nonblocking sends.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setnonblock(int sockfd, int nonblock)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
 	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	client->nonblock = nonblock != 0;
+	pthread_mutex_unlock(client->bufMutex);
+	return 1;
+}
+
+
+// Register the callback seghandler runs when a send buffer that a nonblocking send found
+// full becomes writable again.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_client_setwritable(int sockfd, srt_writable_cb writable, void* ctx)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || clientTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct client_tcb *client = clientTCB[sockfd];
+	pthread_mutex_lock(client->bufMutex);
+	client->writable = writable;
+	client->writableCtx = ctx;
 	pthread_mutex_unlock(client->bufMutex);
 	return 1;
 }
@@ -268,6 +1292,8 @@ int srt_client_send(int sockfd, void* data, unsigned int length)
 // state == CLOSED after the timeout the FINACK was successfully received. Else,
 // if after a number of retries FIN_MAX_RETRY the state is still FINWAIT then
 // the state transitions to CLOSED and -1 is returned.
+// Waiting for the data to be ACKed and for the FINACK are waits on the TCB's condition,
+// which seghandler signals, and sendBuf_timer once the last FIN has timed out.
 
 
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -277,68 +1303,50 @@ int srt_client_disconnect(int sockfd)
 
 	struct client_tcb *client = clientTCB[sockfd];
 
-	//Set up FIN segment
-	seg_t finseg;
-	finseg.header.src_port = client->client_portNum;
-	finseg.header.dest_port = client->svr_portNum;
-	finseg.header.length = 0;
-	finseg.header.type = FIN;
-	finseg.header.seq_num = client->next_seqNum;
-
-	//Set up timespec
-	struct timespec req; 
-	req.tv_nsec = FIN_TIMEOUT;
-
+	pthread_mutex_lock(client->bufMutex);
 	if (client->state == CONNECTED){
 
-		while (client->sendBufHead != NULL){
+		//Send the segment held back for small writes, if any
+		sendBuf_seal(client);
+		sendBuf_flush(client);
+		while (client->sendBufHead != client->sendBufTail){
 			// Wait until all the data has been ACKed
+			pthread_cond_wait(client->bufCond, client->bufMutex);
 		}
 
-		for (int finNum = 0; finNum < FIN_MAX_RETRY; finNum++){
-
-			//Send FIN and transition to FINWAIT
-			snp_sendseg(clientconn, &finseg);
-			client->state = FINWAIT;
-			printf("%d: FIN sent\n", sockfd);
-
-			//Set timer
-			nanosleep(&req, NULL);
+		//Transition to FINWAIT and send FIN. The state changes first so
+		//a fast FINACK is not overwritten by the transition.
+		client->state = FINWAIT;
+		client->ctlTimeouts = 0;
+		sendBuf_ctl(client);
 
-			//Check if connection has closed: (successful receipt of FINACK)
-			if (client->state = CLOSED){
-				printf("%d: Connection closed\n", sockfd);
-
-				pthread_mutex_lock(client->bufMutex);
-				
-				//Free all segBufs
-				struct segBuf *temp;
-				while (client->sendBufHead != NULL){
-					temp = client->sendBufHead->next;
-					free(client->sendBufHead);
-					client->sendBufHead = temp;
+		//Wait for the FINACK while sendBuf_timer sends the FIN up to FIN_MAX_RETRY times
+		while (client->state == FINWAIT && client->ctlTimeouts < FIN_MAX_RETRY){
+			pthread_cond_wait(client->bufCond, client->bufMutex);
+		}
 
-				}
-				pthread_mutex_unlock(client->bufMutex);
-				return 1; 
-			}
+		//Check if connection has closed: (successful receipt of FINACK)
+		if (client->state == CLOSED){
+			printf("%d: Connection closed\n", sockfd);
+			pthread_mutex_unlock(client->bufMutex);
+			return 1; 
 		}
 
 		// Too many FIN attempts- close connection
-		if (client->state == FINWAIT){
-			client->state = CLOSED;
-			printf("%d: Too many disconnect attempts\n", sockfd);
-			return -1;
-		}
+		client->state = CLOSED;
+		printf("%d: Too many disconnect attempts\n", sockfd);
+		pthread_mutex_unlock(client->bufMutex);
+		return -1;
 	}
 	else{
 		printf("%d: ERR- must be first connected to disconnect\n", sockfd);
+		pthread_mutex_unlock(client->bufMutex);
 		return -1; 
 	}
 }
 
 
-// This function calls free() to free the TCB entry. It marks that entry in TCB as NULL
+// This function returns the TCB entry and its buffers to their pools. It marks that entry in TCB as NULL
 // and returns 1 if succeeded (i.e., was in the right state to complete a close) and -1 
 // if fails (i.e., in the wrong state).
 //
@@ -353,9 +1361,28 @@ int srt_client_close(int sockfd)
 	}
 
 	if (client->state == CLOSED){
-		pthread_mutex_destroy(client->bufMutex);
-		free(client);
+		//Once it is out of the hash seghandler no longer finds it; wait for a segment
+		//seghandler found it for before then
+		pthread_mutex_lock(&tableMutex);
+		tcb_unbind(client);
 		clientTCB[sockfd] = NULL;
+		pthread_mutex_unlock(&tableMutex);
+		pthread_mutex_lock(client->bufMutex);
+		pthread_mutex_unlock(client->bufMutex);
+
+		evloop_timer_free(client->rtxTimer);
+		evloop_timer_free(client->corkTimer);
+
+		//Segments left in the ring no longer reference their data
+		for (unsigned int c = client->sendBufHead; c != client->sendBufTail; c++){
+			if (SENDBUF_SLOT(client, c)->done != NULL){
+				SENDBUF_SLOT(client, c)->done(SENDBUF_SLOT(client, c)->ctx);
+			}
+		}
+		pthread_cond_destroy(client->bufCond);
+		pthread_mutex_destroy(client->bufMutex);
+		sendBuf_free(client);
+		slab_free(tcbPool, client);
 		return 1;
 	}
 	else{
@@ -365,84 +1392,155 @@ int srt_client_close(int sockfd)
 }
 
 
-// This is a thread  started by srt_client_init(). It handles all the incoming 
-// segments from the server. The design of seghanlder is an infinite loop that calls snp_recvseg(). If
-// snp_recvseg() fails then the overlay connection is closed and the thread is terminated. Depending
-// on the state of the connection when a segment is received  (based on the incoming segment) various
+// This is the callback srt_client_init() registers with the event loop. It handles all the
+// incoming segments from the server each time the overlay is readable, calling
+// snp_tryrecvseg() until no complete segment is left. If snp_tryrecvseg() fails then the
+// overlay connection is closed and the process exits. Depending on the state of the
+// connection when a segment is received  (based on the incoming segment) various
 // actions are taken. See the client FSM for more details.
+// State changes are made under the TCB's mutex and signaled on its condition, which the
+// blocking calls wait on.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-void *seghandler(void* arg) {
-	struct client_tcb *srtclient;
-	seg_t seg;
-	while (1){
-
-		int m = snp_recvseg(clientconn, &seg);
-		if (m == 1){
-
-			// Identify the TCB the message corresponds to 
-			for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
-				if (clientTCB[i] != NULL){
-					if ((seg.header.dest_port == clientTCB[i]->client_portNum) && (seg.header.src_port == clientTCB[i]->svr_portNum)) {
-						srtclient = clientTCB[i];
+void seghandler(void* arg) {
+	struct client_tcb *srtclient = NULL;
+	seg_t *seg = &rxSeg.seg;
+	int m;
+	srt_sendv_cb done[CWND_MAX_SEGS];
+	void *ctx[CWND_MAX_SEGS];
+	int ndone;
+	srt_writable_cb writable;
+	void *writableCtx;
+	while ((m = snp_tryrecvseg(clientconn, seg)) > 0){
+		ndone = 0;
+		writable = NULL;
+		writableCtx = NULL;
+
+		// Identify the TCB the message corresponds to 
+		pthread_mutex_lock(&tableMutex);
+		srtclient = tcb_lookup(seg);
+		if (srtclient == NULL){
+			pthread_mutex_unlock(&tableMutex);
+			continue;
+		}
+
+
+		//Check state
+		pthread_mutex_lock(srtclient->bufMutex);
+		pthread_mutex_unlock(&tableMutex);
+		switch(srtclient->state){
+			case CLOSED:
+				break;
+			case SYNSENT:
+				if (seg->header.type == SYNACK){
+					//Use the segment size the server agreed to, if the ring can be sized for it;
+					//smaller segments than agreed are always fine
+					srt_synopt_t opt = { MAX_SEG_LEN };
+					if (seg->header.length >= sizeof(srt_synopt_t)){
+						memcpy(&opt, seg->data, sizeof(srt_synopt_t));
+					}
+					if (opt.mss > sendBuf_synmss(srtclient)){
+						opt.mss = sendBuf_synmss(srtclient);
 					}
+					if (opt.mss < MAX_SEG_LEN){
+						opt.mss = MAX_SEG_LEN;
+					}
+					if (opt.mss != srtclient->mss && srtclient->sendBufHead == srtclient->sendBufTail){
+						sendBuf_alloc(srtclient, opt.mss);
+					}
+					srt_cc_init(&srtclient->cc, srtclient->cc.ops, srtclient->mss);
+					srtclient->state = CONNECTED;
+					srtclient->dupAcks = 0;
+					srtclient->sndEdge = srtclient->next_seqNum + ((unsigned int)seg->header.rcv_win << RCV_WIN_SHIFT);
+					srtclient->probeBackoff = 0;
+					evloop_timer_set(srtclient->rtxTimer, 0);
+					//the handshake gives the first RTT sample, unless the SYN was retransmitted
+					if (srtclient->ctlTimeouts == 0){
+						rtt_sample(srtclient, evloop_now() - srtclient->ctlSentTime);
+					}
+					pthread_cond_broadcast(srtclient->bufCond);
 				}
-			}
+				break;
+			case CONNECTED:
+				if (seg->header.type == DATAACK){
+					printf("DATAACK received\n");
+
+					// Free the slots of the ACKed data segments. Wake a sender waiting for room
+					// once the ring becomes writable, and a disconnect waiting for it to empty
+					int wasWritable = SENDBUF_WRITABLE(srtclient);
+					unsigned int freed = sendBuf_ack(srtclient, seg->header.seq_num, done, ctx, &ndone);
+					if (freed > 0
+							&& ((!wasWritable && SENDBUF_WRITABLE(srtclient)) || srtclient->sendBufHead == srtclient->sendBufTail)){
+						pthread_cond_broadcast(srtclient->bufCond);
+						if (srtclient->wantWritable && srtclient->writable != NULL){
+							srtclient->wantWritable = 0;
+							writable = srtclient->writable;
+							writableCtx = srtclient->writableCtx;
+						}
+					}
 
+					//Selective repeat does not resend what the server holds out of order
+					if (srtclient->arq == SRT_ARQ_SR){
+						int n = seg->header.length / sizeof(srt_sack_t);
+						sendBuf_sack(srtclient, (srt_sack_t *)seg->data, n < SACK_MAX_BLOCKS ? n : SACK_MAX_BLOCKS);
+					}
 
-			//Check state
-			switch(srtclient->state){
-				case CLOSED:
-					break;
-				case SYNSENT:
-					if (seg.header.type == SYNACK){
-						srtclient->state = CONNECTED;
+					//The server's receive window only ever moves forward, so a reordered DATAACK
+					//cannot take back room an earlier one gave
+					unsigned int edge = seg->header.seq_num + ((unsigned int)seg->header.rcv_win << RCV_WIN_SHIFT);
+					int opened = SEQ_GT(edge, srtclient->sndEdge);
+					if (opened){
+						srtclient->sndEdge = edge;
+						srtclient->probeBackoff = 0;
 					}
-					break;
-				case CONNECTED:
-					if (seg.header.type == DATAACK){
-						pthread_mutex_lock(srtclient->bufMutex);
-						printf("DATAACK received\n");
-
-						int ACKseg = seg.header.seq_num;
-						struct segBuf *temp;
-
-						// Remove ACKed data segments
-						while ((srtclient->sendBufHead != NULL) && (srtclient->sendBufHead->seg.header.seq_num < ACKseg)){
-							temp = srtclient->sendBufHead;
-							srtclient->sendBufHead = srtclient->sendBufHead->next;
-							srtclient->unAck_segNum--;
-							free(temp);
-
-							//Send the next unsent data
-							if (srtclient->sendBufunSent != NULL){
-								snp_sendseg(clientconn, &srtclient->sendBufunSent->seg);
-								srtclient->sendBufunSent = srtclient->sendBufunSent->next;
-								srtclient->unAck_segNum++;
-							}
-						}
-						pthread_mutex_unlock(srtclient->bufMutex);
+
+					//A duplicate ACK means a segment beyond the oldest one arrived. After dupThresh
+					//of them resend the oldest at once, only once until the ACK moves on. A
+					//window update is not a duplicate
+					if (freed > 0 || srtclient->sendBufHead == srtclient->sendBufunSent){
+						srtclient->dupAcks = 0;
 					}
-					break;
-				case FINWAIT:
-					if (seg.header.type == FINACK){
-						srtclient->state = CLOSED;
+					else if (!opened && ++srtclient->dupAcks == srtclient->dupThresh
+							&& sendBuf_xmit(srtclient, srtclient->sendBufHead, srtclient->sendBufHead + 1, LLONG_MAX) > 0){
+						printf("Fast retransmit\n");
+						srtclient->rtt.fastrtx++;
+						srt_cc_loss(&srtclient->cc, sendBuf_flight(srtclient), evloop_now());
 					}
-					break;
-				default:
-					printf("Connection in unkown state: %d\n", srtclient->state);
-					break;
 
-			}
+					//Send the unsent data the window now allows in one burst, and rearm the timer
+					sendBuf_flush(srtclient);
+				}
+				break;
+			case FINWAIT:
+				if (seg->header.type == FINACK){
+					srtclient->state = CLOSED;
+					evloop_timer_set(srtclient->rtxTimer, 0);
+					pthread_cond_broadcast(srtclient->bufCond);
+				}
+				break;
+			default:
+				printf("Connection in unkown state: %d\n", srtclient->state);
+				break;
+
 		}
-		else if (m == -1){
-			if (srtclient->state == CLOSED){
-				exit(0);
-			}
-			else{
-				printf("receive failed");
-				exit(1);
-			}
+		pthread_mutex_unlock(srtclient->bufMutex);
+
+		//Tell srt_client_sendv() callers whose data has all been ACKed, and a nonblocking
+		//sender that the ring has room again, without the mutex held
+		for (int i = 0; i < ndone; i++){
+			done[i](ctx[i]);
+		}
+		if (writable != NULL){
+			writable(writableCtx);
+		}
+	}
+	if (m == -1){
+		if (srtclient == NULL || srtclient->state == CLOSED){
+			exit(0);
+		}
+		else{
+			printf("receive failed");
+			exit(1);
 		}
 	}
 }
@@ -450,52 +1548,103 @@ void *seghandler(void* arg) {
 
 
 
-// This thread continuously polls send buffer to trigger timeout events
-// It should always be running when the send buffer is not empty
-// If the current time -  first sent-but-unAcked segment's sent time > DATA_TIMEOUT, a timeout event occurs
-// When timeout, resend all sent-but-unAcked segments
-// When the send buffer is empty, this thread terminates
+// This is the callback of the TCB's retransmission timer. In SYNSENT and FINWAIT the SYN or
+// FIN timed out: it is sent again, and once SYN_MAX_RETRY or FIN_MAX_RETRY of them have timed
+// out the waiting srt_client_connect() or srt_client_disconnect() is woken to give up.
+// In CONNECTED, if the current time - first sent-but-unAcked segment's sent time >= the
+// retransmission timeout, a timeout event occurs: the timeout is doubled and all
+// sent-but-unAcked segments are resent, which arms the timer again.
+// Otherwise the timer is moved to the remaining time, or left disarmed when nothing is in flight.
+// When nothing is in flight because the server's receive window is closed, a window probe is
+// sent instead and the timer armed for the next one.
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-void* sendBuf_timer(void* data)
+void sendBuf_timer(void* data)
 {
 
 	struct client_tcb *client = (struct client_tcb *) data;
 
-	struct timespec req;
-	req.tv_nsec = SENDBUF_POLLING_INTERVAL;
-
-	while (client->sendBufHead !=NULL){
-		
-		//sleep
-		nanosleep(&req, NULL);
+	//lock mutex
+	pthread_mutex_lock(client->bufMutex);
 
-		//lock mutex
-		pthread_mutex_lock(client->bufMutex);
+	switch (client->state){
+		case SYNSENT:
+		case FINWAIT:
+			client->ctlTimeouts++;
+			if (client->ctlTimeouts < (client->state == SYNSENT ? SYN_MAX_RETRY : FIN_MAX_RETRY)){
+				sendBuf_ctl(client);
+			}
+			else{
+				pthread_cond_broadcast(client->bufCond);
+			}
+			break;
+		case CONNECTED:
+		{
+			long long now = evloop_now();
+
+			//Zero window: ask the server whether its receive buffer has room again
+			if (client->sendBufHead == client->sendBufNext && client->sendBufNext != SENDBUF_END(client)){
+				sendBuf_probe(client);
+				client->probeBackoff++;
+				client->rtt.probes++;
+				sendBuf_rearm(client, now);
+				break;
+			}
 
-		//Get current time 
-		struct timeval curr, newSent;
-		gettimeofday(&curr, NULL);
-		unsigned int currTime = (1000000 * curr.tv_sec) + curr.tv_usec;
-
-		//Timeout event
-		if ((client->sendBufHead != NULL) && (currTime - client->sendBufHead->sentTime) > DATA_TIMEOUT){
-			printf("Data timeout event\n");
-
-			// Resend all the sent-but-not-ACKed segments
-			struct segBuf *currbuf = client->sendBufHead;
-			int toResend = client->unAck_segNum;
-			while (toResend > 0){
-				snp_sendseg(clientconn, &currbuf->seg);
-				gettimeofday(&newSent, NULL);
-				int sentTime = (1000000 * newSent.tv_sec) + curr.tv_usec;
-				currbuf->sentTime = sentTime; 
-				currbuf = currbuf->next;
-				toResend--;
+			//Timeout event. Go-Back-N goes back to the oldest segment once it has timed out and
+			//resends from there as the congestion window opens again; selective repeat resends only
+			//the timed out segments the server does not hold. Their ACKs give no RTT sample. The
+			//timeout backs off and the window shrinks when the oldest segment is resent, not once
+			//for every segment of the window that expires.
+			int resent = 0;
+			unsigned int flight = sendBuf_flight(client);
+			if (client->arq == SRT_ARQ_GBN){
+				if (client->sendBufHead != client->sendBufunSent){
+					long long sent = SENDBUF_SLOT(client, client->sendBufHead)->sentTime;
+					if (now - (client->ackTime > sent ? client->ackTime : sent) >= client->rtt.rto){
+						srt_cc_timeout(&client->cc, flight, now);
+						client->sendBufNext = client->sendBufHead;
+						resent = sendBuf_flush(client);
+					}
+				}
+			}
+			else{
+				resent = sendBuf_xmit(client, client->sendBufHead, client->sendBufunSent, now - client->rtt.rto + 1);
 			}
+			if (resent > 0){
+				printf("Data timeout event\n");
+				client->rtt.timeouts++;
+				client->dupAcks = 0;
+				if (SENDBUF_SLOT(client, client->sendBufHead)->sentTime >= now){
+					client->rtt.backoff++;
+					rtt_setrto(client);
+					if (client->arq == SRT_ARQ_SR){
+						srt_cc_timeout(&client->cc, flight, now);
+					}
+				}
+			}
+			sendBuf_rearm(client, now);
+			break;
 		}
+		default:
+			break;
+	}
 
-		//unlock mutex
-		pthread_mutex_unlock(client->bufMutex);
+	//unlock mutex
+	pthread_mutex_unlock(client->bufMutex);
+}
+
+
+// This is the callback of the TCB's cork timer. The segment held back for more small writes
+// has waited for the coalescing delay: it is sent as far as the windows allow.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+void sendBuf_corktimer(void* data)
+{
+	struct client_tcb *client = (struct client_tcb *) data;
+
+	pthread_mutex_lock(client->bufMutex);
+	if (client->corked && client->state == CONNECTED){
+		sendBuf_seal(client);
+		sendBuf_flush(client);
 	}
-	return 0;
+	pthread_mutex_unlock(client->bufMutex);
 }
@@ -14,7 +14,11 @@
 #define SRTCLIENT_H
 
 #include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "../common/seg.h"
+#include "../common/evloop.h"
+#include "srt_cc.h"
 
 //client states used in FSM
 #define	CLOSED 1
@@ -22,14 +26,41 @@
 #define	CONNECTED 3
 #define	FINWAIT 4
 
-//unit to store segments in send buffer linked list.
+//retransmission modes, see srt_client_init()
+#define SRT_ARQ_GBN 0           //Go-Back-N: a timeout resends every segment in flight
+#define SRT_ARQ_SR 1            //selective repeat: a timeout resends only the timed out segments the server does not hold
+
+//called on the event loop thread once all the data of a srt_client_sendv() call has been ACKed
+typedef void (*srt_sendv_cb)(void* ctx);
+
+//called on the event loop thread when a send buffer that was full has room again, see srt_client_setwritable()
+typedef void (*srt_writable_cb)(void* ctx);
+
+//slot of the send buffer ring.
+//seg->header.checksum is computed once when the segment is built and reused for every retransmission.
 typedef struct segBuf {
-        seg_t seg;
-        unsigned int sentTime;
-        struct segBuf* next;
+        seg_t* seg;                     //the segment, in storage of the ring with room for mss data bytes
+        long long sentTime;             //evloop_now() when the segment was last sent
+        int retransmitted;              //sent again after a timeout, so its ACK gives no RTT sample (Karn's rule)
+        int sacked;                     //the server holds it out of order, so it is not sent again
+        const char* ext;                //data of a srt_client_sendv() segment in the caller's buffer, NULL when it is in seg->data
+        srt_sendv_cb done;              //set on the last segment of a srt_client_sendv() call, run when it is ACKed
+        void* ctx;                      //argument of done
 } segBuf_t;
 
 
+//RTT estimate and retransmission timeout of a connection, see srt_client_getrtt(). Times are in nanoseconds.
+typedef struct srt_rtt {
+	long long srtt;                 //smoothed RTT, 0 until the first sample
+	long long rttvar;               //RTT variation
+	long long rto;                  //retransmission timeout of the next segment sent, backoff included
+	int backoff;                    //timeouts since the last RTT sample, each doubles rto
+	unsigned long samples;          //RTT samples taken
+	unsigned long timeouts;         //retransmission timeouts
+	unsigned long fastrtx;          //fast retransmits after duplicate ACKs
+	unsigned long probes;           //zero window probes
+} srt_rtt_t;
+
 //client transport control block. the client side of a SRT connection uses this data structure to keep track of the connection information.   
 typedef struct client_tcb {
 	unsigned int svr_nodeID;        //node ID of server, similar as IP address, currently unused
@@ -38,11 +69,40 @@ typedef struct client_tcb {
 	unsigned int client_portNum;    //port number of client
 	unsigned int state;     	//state of client
 	unsigned int next_seqNum;       //next sequence number to be used by new segment 
+	unsigned long long sndOffset;   //stream offset of next_seqNum: the data bytes queued since the connection was made
+	unsigned long long ackOffset;   //stream offset of the oldest byte not ACKed yet
 	pthread_mutex_t* bufMutex;      //send buffer mutex
-	segBuf_t* sendBufHead;          //head of send buffer
-	segBuf_t* sendBufunSent;        //first unsent segment in send buffer
-	segBuf_t* sendBufTail;          //tail of send buffer
-	unsigned int unAck_segNum;      //number of sent-but-not-Acked segments
+	pthread_cond_t* bufCond;        //signaled by seghandler when the state changes or the send buffer empties
+	int sockfd;                     //index of the TCB in the TCB table
+	int arq;                        //retransmission mode, SRT_ARQ_GBN or SRT_ARQ_SR
+	unsigned int dupAcks;           //duplicate DATAACKs received for the oldest segment in flight
+	unsigned int dupThresh;         //duplicate DATAACKs that trigger a fast retransmit, see srt_client_setdupthresh()
+	evloop_timer_t* rtxTimer;       //runs sendBuf_timer when the oldest segment in flight, the SYN or the FIN times out
+	unsigned int ctlTimeouts;       //times the SYN or FIN being sent has timed out
+	long long ctlSentTime;          //evloop_now() when the SYN or FIN was last sent
+	srt_rtt_t rtt;                  //RTT estimate and retransmission timeout
+	srt_cc_t cc;                    //congestion window and the algorithm that manages it
+	long long ackTime;              //evloop_now() when a DATAACK last acknowledged new data
+	unsigned int sndEdge;           //sequence number after the last byte the server's receive window admits
+	int probeBackoff;               //zero window probes since the window last opened, each doubles the probe interval
+	segBuf_t* sendBuf;              //send buffer ring, a cursor c names slot sendBuf[c & (sendBufSlots - 1)]
+	unsigned int sendBufSlots;      //number of slots in the ring, a power of 2 sized from SEND_BUF_SIZE and mss
+	unsigned int mss;               //data bytes of a full segment, the segment size agreed in the SYN and SYNACK
+	unsigned int wantMss;           //segment size the SYN proposes, see srt_client_setmss()
+	unsigned int sendBufHead;       //cursor of the oldest sent-but-not-Acked segment
+	unsigned int sendBufNext;       //cursor of the next segment to send, behind sendBufunSent while Go-Back-N resends
+	unsigned int sendBufunSent;     //cursor of the first segment never sent
+	unsigned int sendBufTail;       //cursor of the next free slot, the ring is empty when it equals sendBufHead
+	unsigned int sendBufBytes;      //data bytes of the segments in the ring
+	unsigned int sendBufLimit;      //most data bytes the ring may hold, see srt_client_setsndbuf()
+	int nonblock;                   //sends return instead of waiting when the ring is full
+	int wantWritable;               //a nonblocking send found the ring full since writable last ran
+	srt_writable_cb writable;       //run once the ring has room again after wantWritable was set
+	void* writableCtx;              //argument of writable
+	long long corkDelay;            //longest a segment shorter than mss is held for more data, 0 if writes are not coalesced
+	int corked;                     //the segment before sendBufTail is held back while small writes fill it
+	evloop_timer_t* corkTimer;      //runs sendBuf_corktimer corkDelay after the held segment was started
+	struct client_tcb* hashNext;    //next TCB in the same demultiplexing hash chain
 } client_tcb_t;
 
 
@@ -68,9 +128,21 @@ void srt_client_init(int conn);
 
 // This function initializes the TCB table marking all entries NULL. It also initializes 
 // a global variable for the overlay TCP socket descriptor ``conn'' used as input parameter
-// for snp_sendseg and snp_recvseg. Finally, the function starts the seghandler thread to 
-// handle the incoming segments. There is only one seghandler for the client side which
-// handles call connections for the client.
+// for snp_sendseg and snp_recvseg. Finally, the function starts the event loop and registers
+// seghandler to handle the incoming segments whenever the overlay is readable. There is only
+// one seghandler for the client side which handles call connections for the client.
+// The SRT_ARQ environment variable picks the retransmission mode of the sockets created
+// afterwards: gbn for Go-Back-N, sr for selective repeat; SRT_DEFAULT_ARQ if it is not set.
+// Likewise SRT_CC picks their congestion control, reno or cubic; SRT_DEFAULT_CC if it is not set,
+// and SRT_CORK their coalescing delay in microseconds; CORK_DELAY if it is not set.
+// SRT_MSS sets the segment size they propose, see srt_client_setmss(); SRT_DEFAULT_MSS if it is not set.
+// With selective repeat the selective ACK blocks of every DATAACK mark the segments the
+// server holds out of order, and a timeout resends only the segments that are neither ACKed
+// nor held and were sent one retransmission timeout ago.
+// Every SYNACK and DATAACK advertises the room left in the server's receive buffer in rcv_win,
+// and the client never sends past it. While that window is too small for the next segment and
+// nothing is in flight, sendBuf_timer sends zero length DATA probes, one retransmission timeout
+// apart and doubling up to RTO_MAX, whose DATAACKs tell when the window opens again.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -78,7 +150,7 @@ void srt_client_init(int conn);
 int srt_client_sock(unsigned int client_port);
 
 // This function looks up the client TCB table to find the first NULL entry, and creates
-// a new TCB entry using malloc() for that entry. All fields in the TCB are initialized 
+// a new TCB entry taken from the TCB pool for that entry. All fields in the TCB are initialized 
 // e.g., TCB state is set to CLOSED and the client port set to the function call parameter 
 // client port.  The TCB table entry index should be returned as the new socket ID to the client 
 // and be used to identify the connection on the client side. If no entry in the TC table  
@@ -92,10 +164,10 @@ int srt_client_connect(int socked, unsigned int server_port);
 // This function is used to connect to the server. It takes the socket ID and the 
 // server's port number as input parameters. The socket ID is used to find the TCB entry.  
 // This function sets up the TCB's server port number and a SYN segment to send to
-// the server using snp_sendseg(). After the SYN segment is sent, a timer is started. 
-// If no SYNACK is received after SYNSEG_TIMEOUT timeout, then the SYN is 
-// retransmitted. If SYNACK is received, return 1. Otherwise, if the number of SYNs 
-// sent > SYN_MAX_RETRY,  transition to CLOSED state and return -1.
+// the server using snp_sendseg(). After the SYN segment is sent, the TCB's retransmission
+// timer is armed. If no SYNACK is received after SYN_TIMEOUT, sendBuf_timer retransmits
+// the SYN. If SYNACK is received, return 1. Otherwise, once SYN_MAX_RETRY SYNs have
+// timed out, transition to CLOSED state and return -1.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -103,29 +175,203 @@ int srt_client_connect(int socked, unsigned int server_port);
 int srt_client_send(int sockfd, void* data, unsigned int length);
 
 // Send data to a srt server. This function should use the SRT socket ID to find the TCP entry. 
-// It creates segBufs using the given data and append them to send linked list. 
-// If the send buffer is empty before insertion, a thread called sendbuf_timer 
-// should be started to poll the send buffer every SENDBUF_POLLING_INTERVAL time
-// to check if a timeout event should occur. If the function completes successfully, 
-// it returns 1. Otherwise, it returns -1. srt_client_send is a non-blocking function call.
+// It copies exactly length bytes of data into segBufs at the tail of the send buffer ring;
+// the data may hold any bytes, including NULs.
+// Whenever the oldest segment in flight is sent, the TCB's retransmission timer is armed
+// to run sendBuf_timer one retransmission timeout later, see srt_client_getrtt(). If the function completes successfully, 
+// it returns 1. Otherwise, it returns -1. srt_client_send only blocks while the ring is
+// full, in slots or in bytes (see srt_client_setsndbuf()), until ACKs free enough of it for
+// the rest of the data; it returns -1 if the connection leaves CONNECTED meanwhile. On a
+// nonblocking socket it returns the number of bytes queued instead, see srt_client_setnonblock().
 // Because user data is fragmented into fixed sized SRT segments there may be
-// multiple segBufs queued to the send link list for a single srt_client_send call.
-// If the call is successful the data is queued on the TCB send linked list and
+// multiple segBufs queued to the send buffer ring for a single srt_client_send call.
+// If the call is successful the data is queued on the TCB send buffer ring and
 // depending on the condition of the sliding window the data will either be
 // transmitted over the network or queued waiting to be transmitted. 
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 
+int srt_client_sendv(int sockfd, const struct iovec* iov, int iovcnt, srt_sendv_cb done, void* ctx);
+
+// Send the data of the iovec array to a srt server without copying it. The segments queued on
+// the send buffer ring only hold their headers and point into the caller's buffers, and every
+// transmission and retransmission gathers the data straight from them. A segment never spans
+// two iovecs, so every iovec should be many segment sizes long for full sized segments.
+// Once the last byte has been ACKed, done(ctx) is called on the event loop thread; from then on
+// the caller may reuse the buffers. Until then they must stay unchanged, unless the socket is
+// closed with srt_client_close() first. done must not block. done may be NULL.
+// Like srt_client_send() it only blocks while the ring is full, and returns 1 in case of
+// success and -1 if the connection leaves CONNECTED.
+// On a nonblocking socket it returns the number of bytes queued, see srt_client_setnonblock().
+// done is called exactly once for every call except one that fails with EAGAIN: even after
+// a failure, once no queued segment references the buffers any more. srt_client_close()
+// calls it for the data that was never ACKed.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+long srt_client_sendfile(int sockfd, int fd, off_t offset, size_t count);
+
+// Send count bytes of the file open on fd, starting at offset, to a srt server without
+// reading it into memory first. The file is mapped with mmap() SENDFILE_WINDOW bytes at a
+// time and its segments point into the mapping like those of srt_client_sendv(). A window is
+// only mapped once the send buffer has taken the one before, and it is unmapped once all of
+// its data has been ACKed, so files of any size are sent with memory bounded by the send
+// buffer limit and a few windows. A file that cannot be mapped is read with pread()
+// instead. The file offset of fd is not changed, and the file must not shrink meanwhile.
+// A descriptor that cannot seek, such as a pipe or a socket, is read with read() from its
+// current position, and offset is ignored.
+// Returns the number of bytes queued, which is less than count only at the end of the file
+// or on a nonblocking socket, and -1 with errno set by the read in case of a read error
+// before anything was queued, or -1 in case of another failure; like srt_client_send() it returns
+// -1 with errno set to EAGAIN on a nonblocking socket when nothing fits.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setsndbuf(int sockfd, unsigned int bytes);
+
+// Set the most data bytes the send buffer of the socket may hold. A segment is only queued
+// if it fits within the limit, so memory per socket stays bounded whatever the application
+// sends. The limit is raised to at least one segment and lowered to what the send buffer
+// ring holds, which depends on SEND_BUF_SIZE, the default limit, and the segment size.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setcork(int sockfd, long long delay);
+
+// Coalesce small writes on the socket: the data of srt_client_send() calls that leaves a segment
+// shorter than the segment size is held in the tail segment of the send buffer ring, and the data of
+// the next calls is appended to it. The segment is sent once it is full, delay nanoseconds
+// after its first byte was written, or when srt_client_flush() or srt_client_disconnect() is
+// called. srt_client_sendv() segments point into the caller's buffers and are never held.
+// A delay of 0 turns coalescing off and sends a segment held so far. CORK_DELAY by default.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_flush(int sockfd);
+
+// Send the segment srt_client_setcork() holds back for more small writes now, as far as the
+// windows allow, instead of when it is full or its delay expires.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setmss(int sockfd, unsigned int mss);
+
+// Set the segment size the socket proposes in the data of its next SYN, from MAX_SEG_LEN up to
+// JUMBO_SEG_LEN; SRT_DEFAULT_MSS by default. The server answers in the SYNACK with the size both
+// sides use: the proposal, lowered to what its overlay connection carries. The proposal
+// itself is lowered to what the client's overlay carries (see snp_getmaxseg()), and a server
+// that answers without a size agrees to MAX_SEG_LEN. Once connected, every full segment holds
+// that many data bytes and the congestion window counts segments of that size. The send buffer
+// ring is sized for it: with larger segments it gets fewer, larger slots, so small writes
+// fill it sooner unless srt_client_setcork() coalesces them. Only a socket that is not
+// connected can change its proposal.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setnonblock(int sockfd, int nonblock);
+
+// Switch the socket between blocking mode, the default, and nonblocking mode. In blocking
+// mode srt_client_send() and srt_client_sendv() wait while the send buffer is full, until
+// ACKs have freed a quarter of it, and return 1 once all data is queued. In nonblocking mode
+// they queue what fits and return at once with the number of bytes queued, which may be
+// less than asked; if nothing fits they return -1 and set errno to EAGAIN. A sendv call that
+// queued only part of its data calls its done callback once that part has been ACKed.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setwritable(int sockfd, srt_writable_cb writable, void* ctx);
+
+// Register writable(ctx) as the writable event of the socket, or remove it with NULL. After a
+// nonblocking send has found the send buffer full, writable is called once on the event loop
+// thread when ACKs have freed a quarter of the buffer, so the caller can send the rest. It
+// must not block. Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_getrtt(int sockfd, srt_rtt_t* rtt);
+
+// Copy the RTT estimate and retransmission timeout of the socket into rtt. Every DATAACK
+// that acknowledges new data gives an RTT sample from the sent time of the newest segment it
+// covers, unless that segment was retransmitted (Karn's rule); the SYNACK gives the first one
+// unless the SYN was retransmitted. The samples are smoothed as by Jacobson and Karels:
+// srtt += (sample - srtt) / 8, rttvar += (|sample - srtt| - rttvar) / 4, and the timeout is
+// srtt + 4 * rttvar, at least RTO_MIN and one timer tick above srtt. Until the first sample it
+// is RTO_INIT. Every timeout doubles it, up to RTO_MAX, until the next sample. The
+// timeouts and fastrtx counters tell how many losses were repaired by each mechanism, and
+// probes how many zero window probes were sent while the server's receive buffer was full.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_getoffsets(int sockfd, unsigned long long* queued, unsigned long long* acked);
+
+// Copy the stream offsets of the socket since it connected: the data bytes queued in *queued
+// and the data bytes the server has ACKed in *acked. The sequence number of a byte is its
+// offset plus 1 in 32 bits, which wraps every 4 GB; sequence numbers are only compared with
+// SEQ_LT() and friends, so a connection carries any number of bytes.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setcc(int sockfd, int algo);
+
+// Manage the congestion window of the socket with algorithm algo, SRT_CC_RENO or
+// SRT_CC_CUBIC (see srt_cc.h). The window starts over at CWND_INIT_SEGS segments. Data is only sent
+// while the bytes in flight fit in the window, and at most CWND_MAX_SEGS segments are in flight.
+// Independently of it, no byte is sent beyond the receive window the server advertised in
+// its last SYNACK or DATAACK.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_getcc(int sockfd, srt_cc_t* cc);
+
+// Copy the congestion control state of the socket into cc: its window, slow start threshold,
+// the largest window it reached and the number of reductions after losses and timeouts.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_client_setdupthresh(int sockfd, unsigned int dupacks);
+
+// Set the number of duplicate DATAACKs after which the oldest segment in flight is resent at
+// once (fast retransmit), DUPACK_THRESH by default. A DATAACK is a duplicate when it ACKs no
+// new data while segments are in flight: the server sends one for every segment that arrives
+// beyond a gap. The segment is resent only once per gap, the RTO does not back off, and its
+// ACK gives no RTT sample. 0 turns fast retransmit off, so losses wait for the timeout.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
 int srt_client_disconnect(int sockfd);
 
 // This function is used to disconnect from the server. It takes the socket ID as 
 // an input parameter. The socket ID is used to find the TCB entry in the TCB table.  
 // This function sends a FIN segment to the server. After the FIN segment is sent
-// the state should transition to FINWAIT and a timer started. If the 
-// state == CLOSED after the timeout the FINACK was successfully received. Else,
-// if after a number of retries FIN_MAX_RETRY the state is still FINWAIT then
+// the state should transition to FINWAIT and the TCB's retransmission timer is armed;
+// sendBuf_timer retransmits the FIN every FIN_TIMEOUT. If the state becomes CLOSED
+// the FINACK was successfully received. Else, once FIN_MAX_RETRY FINs have timed out,
 // the state transitions to CLOSED and -1 is returned.
+// A segment held back for more small writes (see srt_client_setcork()) is sent first.
 
 
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -133,31 +379,45 @@ int srt_client_disconnect(int sockfd);
 
 int srt_client_close(int sockfd);
 
-// This function calls free() to free the TCB entry. It marks that entry in TCB as NULL
+// This function returns the TCB entry and its buffers to their pools. It marks that entry in TCB as NULL
 // and returns 1 if succeeded (i.e., was in the right state to complete a close) and -1 
 // if fails (i.e., in the wrong state).
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 
-void *seghandler(void* arg);
+void seghandler(void* arg);
 
-// This is a thread  started by srt_client_init(). It handles all the incoming 
-// segments from the server. The design of seghanlder is an infinite loop that calls snp_recvseg(). If
-// snp_recvseg() fails then the overlay connection is closed and the thread is terminated. Depending
-// on the state of the connection when a segment is received  (based on the incoming segment) various
+// This is the callback srt_client_init() registers with the event loop. It handles all the
+// incoming segments from the server each time the overlay is readable, calling
+// snp_tryrecvseg() until no complete segment is left. If snp_tryrecvseg() fails then the
+// overlay connection is closed and the process exits. Depending on the state of the
+// connection when a segment is received  (based on the incoming segment) various
 // actions are taken. See the client FSM for more details.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
 
-void* sendBuf_timer(void* clienttcb);
+void sendBuf_timer(void* clienttcb);
 
-// This thread continuously polls send buffer to trigger timeout events
-// It should always be running when the send buffer is not empty
-// If the current time -  first sent-but-unAcked segment's sent time > DATA_TIMEOUT, a timeout event occurs
-// When timeout, resend all sent-but-unAcked segments
-// When the send buffer is empty, this thread terminates
+// This is the callback of the TCB's retransmission timer, which the event loop runs when the
+// timer expires. In SYNSENT and FINWAIT the SYN or FIN timed out: it is retransmitted until
+// SYN_MAX_RETRY or FIN_MAX_RETRY of them have timed out, then the waiting call gives up.
+// In CONNECTED the timer is kept armed for the retransmission timeout after the sent time of the
+// oldest sent-but-unAcked segment, or after the last ACK of new data if that is later. If the
+// current time - that time >= the timeout, a timeout event occurs: the timeout is backed off,
+// the congestion window shrinks to one segment and Go-Back-N goes back to the oldest segment,
+// resending the segments in flight again as the window opens. Selective repeat resends only
+// the segments whose own timeout has expired, see srt_client_init().
+// When no segment is in flight, the timer is not armed again
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+void sendBuf_corktimer(void* clienttcb);
+
+// This is the callback of the TCB's cork timer, which srt_client_send() arms when it starts to
+// hold a segment shorter than the segment size for more small writes. Once the coalescing delay has
+// passed, the segment is sent as far as the windows allow.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
 #endif
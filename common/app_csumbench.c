@@ -0,0 +1,94 @@
+//FILE: common/app_csumbench.c
+//
+//Description: this is the checksum microbenchmark. For every checksum kernel the cpu supports (scalar, sse2 and avx2, see checksum_setkernel()) it times checksum_partial(), which checksum() and checkchecksum() use, and checksum_copy(), which sums the data while it copies it into a segment, over a segment header and the data lengths of small, full and jumbo segments. It prints the cost in nanoseconds and TSC cycles per byte and the folded sum, which is the same for every kernel.
+
+//Input: megabytes summed per measurement (default BENCH_MB) as the first argument
+
+//Output: one line per kernel, function and segment size
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "constants.h"
+#include "seg.h"
+
+//megabytes summed per measurement when no argument is given
+#define BENCH_MB 64
+//every measurement is repeated BENCH_RUNS times and the fastest run is reported
+#define BENCH_RUNS 3
+
+static const char* kernels[] = { "scalar", "sse2", "avx2" };
+static const int seglens[] = { 64, 512, MAX_SEG_LEN, 9000, JUMBO_SEG_LEN };
+
+static unsigned long long rdcycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+int main(int argc, char** argv) {
+	long long total = (argc > 1 ? atoll(argv[1]) : BENCH_MB) * 1000000LL;
+	int size = SEG_SIZE(JUMBO_SEG_LEN);
+	unsigned char* src = malloc(size);
+	unsigned char* dst = malloc(size);
+	if (src == NULL || dst == NULL) {
+		printf("out of memory\n");
+		return 1;
+	}
+	unsigned int x = 2463534242u;
+	for (int i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		src[i] = x;
+	}
+
+	printf("%-7s %-9s %6s %8s %12s %8s %6s\n", "kernel", "function", "seglen", "ns/byte", "cycles/byte", "GB/s", "sum");
+	for (int k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+		if (checksum_setkernel(kernels[k]) < 0) {
+			printf("%-7s not supported by this cpu\n", kernels[k]);
+			continue;
+		}
+		for (int copy = 0; copy < 2; copy++) {
+			for (int s = 0; s < (int)(sizeof(seglens) / sizeof(seglens[0])); s++) {
+				int len = sizeof(srt_hdr_t) + seglens[s];
+				long long iters = total / len > 0 ? total / len : 1;
+				double best = 0;
+				unsigned long long bestCycles = 0;
+				unsigned long long sum = 0;
+
+				for (int run = 0; run <= BENCH_RUNS; run++) {
+					struct timespec start, end;
+					clock_gettime(CLOCK_MONOTONIC, &start);
+					unsigned long long c0 = rdcycles();
+					for (long long i = 0; i < iters; i++) {
+						if (copy)
+							sum = checksum_copy(dst, src, len, 0);
+						else
+							sum = checksum_partial(src, len, 0);
+					}
+					unsigned long long cycles = rdcycles() - c0;
+					clock_gettime(CLOCK_MONOTONIC, &end);
+					double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+					//run 0 warms the caches up and is not counted
+					if (run > 0 && (best == 0 || ns < best)) {
+						best = ns;
+						bestCycles = cycles;
+					}
+				}
+				double bytes = (double)iters * len;
+				printf("%-7s %-9s %6d %8.3f %12.3f %8.2f  %04x\n", kernels[k], copy ? "copy" : "partial", seglens[s],
+					best / bytes, bestCycles / bytes, bytes / best, checksum_fold(sum));
+			}
+		}
+	}
+	free(src);
+	free(dst);
+	return 0;
+}
@@ -10,15 +10,21 @@
 //overlay port opened by the server. the client will connect to this port. You should choose a random port to avoid conflicts with your classmates. Because you may log onto the same computer.
 #define OVERLAY_PORT 9003
 //this is the MAX connections can be supported by SRT. You TCB table should contain MAX_TRANSPORT_CONNECTIONS entries
-#define MAX_TRANSPORT_CONNECTIONS 10
+#define MAX_TRANSPORT_CONNECTIONS 1024
 //Maximum segment length
 //MAX_SEG_LEN = 1500 - sizeof(seg header) - sizeof(ip header)
+//It is the segment size of a connection unless a larger one is negotiated, see srt_client_setmss()
 #define MAX_SEG_LEN  1464
+//largest segment size a connection can negotiate: a segment and its header fill a UDP datagram
+//of 65507 bytes, and a framed one fits in SNP_RXBUF_SIZE
+#define JUMBO_SEG_LEN 65483
 //The packet loss rate is 10%
 #define PKT_LOSS_RATE 0.1
+//max number of SYNs the server holds for ports with no TCB in srt_server_accept() yet
+#define SYN_BACKLOG 256
 //SYN_TIMEOUT value in nano seconds
 #define SYN_TIMEOUT 100000000
-//SYN_TIMEOUT value in nano seconds
+//FIN_TIMEOUT value in nano seconds
 #define FIN_TIMEOUT 100000000
 //max number of SYN retransmissions in srt_client_connect()
 #define SYN_MAX_RETRY 5
@@ -26,18 +32,90 @@
 #define FIN_MAX_RETRY 5
 //server close wait timeout value in seconds
 #define CLOSEWAIT_TIMEOUT 1
-//sendBuf_timer thread's polling interval in nanoseconds
-#define SENDBUF_POLLING_INTERVAL 100000000
-//srt server polls the receive buffer with this time interval in order 
-//to check if requested data is available in srt_srv_recv() function
-//in seconds
-#define RECVBUF_POLLING_INTERVAL 1
-//srt_svr_accept() function uses this interval in nanoseconds to busy wait on the tcb state
-#define ACCEPT_POLLING_INTERVAL 100000000
 //size of receive buffer
 #define RECEIVE_BUF_SIZE 1000000
-//DATA segment timeout value in microseconds
-#define DATA_TIMEOUT 1000
-//GBN window size
-#define GBN_WINDOW 10
+//the receive window in the rcv_win header field counts units of 1 << RCV_WIN_SHIFT bytes, so
+//that the 16-bit field can advertise all of RECEIVE_BUF_SIZE
+#define RCV_WIN_SHIFT 5
+//the server delays the DATAACK of in-order DATA until DELACK_SEGS segments wait for one or
+//DELACK_TIMEOUT nanoseconds have passed since the first of them, see srt_server_setdelack();
+//1 ACKs every segment, which is the default; SRT_DELACK or srt_server_setdelack() turn delayed
+//ACKs on. The timeout must stay well below RTO_MIN
+#define DELACK_SEGS 1
+#define DELACK_TIMEOUT 200000
+//default per-socket byte limit of the client send buffer. The ring gets the smallest power of 2
+//number of slots of the connection's segment size that holds it, and at least CWND_INIT_SEGS
+//slots; srt_client_setsndbuf() can lower the limit or raise it up to what the ring holds
+#define SEND_BUF_SIZE 1048576
+//srt_client_sendfile() maps the file this many bytes at a time, must be a multiple of the page size
+#define SENDFILE_WINDOW 1048576
+//bytes srt_client_sendfile() reads at a time from a descriptor it cannot map
+#define SENDFILE_PREAD 65536
+//DATA segment retransmission timeout in nanoseconds until the connection has an RTT sample
+#define RTO_INIT 100000000
+//bounds of the retransmission timeout computed from the RTT, in nanoseconds. A timeout doubles
+//it for the segments sent next, up to RTO_MAX
+#define RTO_MIN 1000000
+#define RTO_MAX 60000000000LL
+//initial congestion window of a client connection, in full segments of its segment size
+#define CWND_INIT_SEGS 10
+//largest congestion window in full segments. It also bounds the number of segments in flight,
+//so it must stay below RECEIVE_BUF_SIZE / MAX_SEG_LEN for the server to hold a whole window
+//of default sized segments; with larger ones the receive window is the limit
+#define CWND_MAX_SEGS 512
+//congestion control of new client sockets when SRT_CC is not set in the environment
+//(see SRT_CC_RENO and SRT_CC_CUBIC in srt_cc.h)
+#define SRT_DEFAULT_CC SRT_CC_CUBIC
+//nanoseconds a new client socket holds a segment shorter than its segment size for more small sends
+//to coalesce into, see srt_client_setcork(); 0 sends every write at once. SRT_CORK sets it in microseconds
+#define CORK_DELAY 0
+//default number of duplicate DATAACKs for the oldest segment in flight after which it is
+//resent at once instead of at its timeout, see srt_client_setdupthresh(); 0 disables it
+#define DUPACK_THRESH 3
+//max number of out-of-order ranges the server holds per connection and reports as selective ACK
+//blocks in a DATAACK; a segment that would need one more range is dropped
+#define SACK_MAX_BLOCKS 32
+//segment size new client sockets propose in their SYN when SRT_MSS is not set in the environment,
+//see srt_client_setmss()
+#define SRT_DEFAULT_MSS MAX_SEG_LEN
+//retransmission mode of new client sockets when SRT_ARQ is not set in the environment
+//(see SRT_ARQ_GBN and SRT_ARQ_SR in srt_client.h)
+#define SRT_DEFAULT_ARQ SRT_ARQ_GBN
+//snp_recvseg() framing mode used when SNP_FRAMING is not set in the environment
+//(see SNP_FRAMING_DELIM and SNP_FRAMING_LENGTH in seg.h)
+#define SNP_DEFAULT_FRAMING SNP_FRAMING_LENGTH
+//size of the per-connection overlay receive ring in bytes, must be a power of 2
+#define SNP_RXBUF_SIZE 65536
+//socket buffer size the stress applications ask for on a UDP overlay, so a window of
+//segments sent in one sendmmsg() burst is not dropped by the receiving socket
+#define OVERLAY_UDP_BUFSIZE 4194304
+//number of MAX_SEG_LEN segment slots in each direction of the shared memory overlay, must be a power of 2
+#define SNP_SHM_SLOTS 256
+//the shared memory overlay checks whether its peer is still there at this interval in
+//nanoseconds while it waits on an empty or full ring
+#define SNP_SHM_WAIT_TIMEOUT 100000000
+//max number of segments snp_sendseg_batch() gathers into one overlay syscall
+#define SNP_MAX_BATCH 64
+//the SNP layer keeps per-connection state for overlay socket descriptors below this value
+#define SNP_MAX_CONN 4096
+//number of buffers the io_uring engine provides to its multishot receive, must be a power of 2
+#define SNP_URING_BUFS 16
+//size in bytes of each io_uring engine receive buffer
+#define SNP_URING_BUFSIZE 16384
+//max number of overlay connections the server accepts per event loop callback, so that
+//segments of connections already accepted are handled in between
+#define OVERLAY_ACCEPT_BATCH 8
+//max number of events the event loop handles per epoll_wait()
+#define EVLOOP_MAX_EVENTS 64
+//resolution of the event loop timers in nanoseconds
+#define EVLOOP_TIMER_TICK 100000
+//number of levels of the timer wheel, each 64 times coarser than the one below. 4 levels of
+//EVLOOP_TIMER_TICK cover about 28 minutes; later expiries wait in the top level
+#define EVLOOP_WHEEL_LEVELS 4
+//a thread moves this many bytes worth of objects, and at most SLAB_CACHE_OBJS objects, between
+//its cache and a slab pool's shared free list at once
+#define SLAB_CACHE_BYTES 65536
+#define SLAB_CACHE_OBJS 32
+//number of TCBs carved out of each slab of the client and server TCB pools
+#define TCB_PER_SLAB 16
 #endif
@@ -0,0 +1,424 @@
+//FILE: common/evloop.c
+//
+//Description: single thread epoll event loop with a hierarchical timer wheel that drives the
+//overlay connection and the connection timers of the SRT client and server
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "constants.h"
+#include "evloop.h"
+#include "slab.h"
+
+//number of slots in every level of the timer wheel, as a power of 2
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+//slot of a timer that has expired and waits for its callback to run
+#define WHEEL_FIRED -1
+
+//one registered descriptor, or a timer
+typedef struct watch {
+	int fd;
+	int dead;                   //freed while a batch of events may still name it
+	evloop_fn fn;
+	void* arg;
+	struct watch* nextdead;
+	struct watch* nextkick;
+	struct watch* nextfd;       //descriptors added with evloop_add_fd(), for evloop_del_fd()
+} watch_t;
+
+struct evloop_timer {
+	watch_t w;
+	unsigned long long expires; //wheel tick at which the timer expires
+	int slot;                   //level * WHEEL_SLOTS + index of its wheel slot, or WHEEL_FIRED
+	struct evloop_timer* next;
+	struct evloop_timer** pprev;//link to the timer in its list, NULL while disarmed
+};
+
+static int epfd = -1;
+static pthread_t loopthread;
+static pthread_once_t loop_once = PTHREAD_ONCE_INIT;
+//held while callbacks run, so a timer is never freed under its own callback
+static pthread_mutex_t loop_mutex = PTHREAD_MUTEX_INITIALIZER;
+//watches freed since the loop last returned from epoll_wait(), and how many there are
+static watch_t* deadlist = NULL;
+static int deadnum = 0;
+//every watch but kickwatch comes from this pool
+static slab_pool_t* watchpool = NULL;
+//descriptors added since the loop last ran their callbacks, and the eventfd that tells it
+static watch_t* kicklist = NULL;
+static watch_t kickwatch;
+//descriptors added with evloop_add_fd()
+static watch_t* fdlist = NULL;
+
+//the timer wheel. Level l has WHEEL_SLOTS slots of WHEEL_SLOTS^l ticks each; a timer sits in the
+//lowest level whose range holds its expiry, and moves down a level every time the wheel reaches
+//its slot, so arming and disarming are O(1). One timerfd, the wheelwatch, is armed at the first
+//tick at which the wheel has anything to do. wheelMutex guards everything below; it is only
+//ever taken last, so timers can be armed from any thread and from callbacks.
+static pthread_mutex_t wheelMutex = PTHREAD_MUTEX_INITIALIZER;
+static evloop_timer_t* wheel[EVLOOP_WHEEL_LEVELS * WHEEL_SLOTS];
+static unsigned long long wheelmap[EVLOOP_WHEEL_LEVELS];    //bit i of level l: slot i is not empty
+static unsigned long long wheelnow = 0;         //last tick the wheel has handled
+static unsigned long long wheelarmed = ~0ULL;   //tick the timerfd is armed for, ~0 if disarmed
+static long long wheelbase;                     //evloop_now() at tick 0
+static evloop_timer_t* fired = NULL;            //expired timers whose callbacks have not run yet
+static watch_t wheelwatch;
+
+long long evloop_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+//remove a timer from its wheel slot or the fired list. The caller holds wheelMutex.
+static void wheel_unlink(evloop_timer_t* t) {
+	if (t->pprev == NULL)
+		return;
+	*t->pprev = t->next;
+	if (t->next != NULL)
+		t->next->pprev = t->pprev;
+	if (t->slot != WHEEL_FIRED && wheel[t->slot] == NULL)
+		wheelmap[t->slot / WHEEL_SLOTS] &= ~(1ULL << (t->slot % WHEEL_SLOTS));
+	t->pprev = NULL;
+}
+
+static void wheel_push(evloop_timer_t** list, evloop_timer_t* t) {
+	t->next = *list;
+	if (t->next != NULL)
+		t->next->pprev = &t->next;
+	*list = t;
+	t->pprev = list;
+}
+
+//put a timer in the slot of the lowest level whose range from wheelnow holds its expiry.
+//Expiries beyond the top level wait in its farthest slot and are placed again from there.
+//The caller holds wheelMutex.
+static void wheel_place(evloop_timer_t* t) {
+	unsigned long long delta = t->expires > wheelnow ? t->expires - wheelnow : 0;
+	unsigned long long expires = t->expires;
+	int level = 0;
+	while (level < EVLOOP_WHEEL_LEVELS - 1 && delta >= 1ULL << (WHEEL_BITS * (level + 1)))
+		level++;
+	if (delta >= 1ULL << (WHEEL_BITS * (level + 1)))
+		expires = wheelnow + (1ULL << (WHEEL_BITS * (level + 1))) - 1;
+	int index = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+	t->slot = level * WHEEL_SLOTS + index;
+	wheel_push(&wheel[t->slot], t);
+	wheelmap[level] |= 1ULL << index;
+}
+
+//the first tick after wheelnow at which a slot of the wheel is due: a level 0 slot expires,
+//or a higher level slot moves down. ~0 if the wheel is empty. The caller holds wheelMutex.
+static unsigned long long wheel_next() {
+	unsigned long long next = ~0ULL;
+	for (int level = 0; level < EVLOOP_WHEEL_LEVELS; level++) {
+		if (wheelmap[level] == 0)
+			continue;
+		unsigned long long cur = wheelnow >> (WHEEL_BITS * level);
+		int from = (cur + 1) & (WHEEL_SLOTS - 1);
+		unsigned long long map = wheelmap[level];
+		map = from == 0 ? map : (map >> from) | (map << (WHEEL_SLOTS - from));
+		unsigned long long tick = (cur + 1 + __builtin_ctzll(map)) << (WHEEL_BITS * level);
+		if (tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+//arm the timerfd for a tick, or disarm it for ~0. The caller holds wheelMutex.
+static void wheel_arm(unsigned long long tick) {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if (tick != ~0ULL) {
+		long long at = wheelbase + (long long)tick * EVLOOP_TIMER_TICK;
+		its.it_value.tv_sec = at / 1000000000LL;
+		its.it_value.tv_nsec = at % 1000000000LL;
+	}
+	wheelarmed = tick;
+	timerfd_settime(wheelwatch.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+//turn the wheel up to the current tick, moving the timers that expire on the way to the fired
+//list. Ticks at which no slot is due are skipped. The caller holds wheelMutex.
+static void wheel_advance() {
+	unsigned long long now = (evloop_now() - wheelbase) / EVLOOP_TIMER_TICK;
+	unsigned long long next;
+	while ((next = wheel_next()) <= now) {
+		wheelnow = next;
+		//move the due slots down, the highest level first
+		int level = 0;
+		while (level < EVLOOP_WHEEL_LEVELS - 1 && (next & ((1ULL << (WHEEL_BITS * (level + 1))) - 1)) == 0)
+			level++;
+		for (; level > 0; level--) {
+			int slot = level * WHEEL_SLOTS + ((next >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+			while (wheel[slot] != NULL) {
+				evloop_timer_t* t = wheel[slot];
+				wheel_unlink(t);
+				wheel_place(t);
+			}
+		}
+		int slot = next & (WHEEL_SLOTS - 1);
+		while (wheel[slot] != NULL) {
+			evloop_timer_t* t = wheel[slot];
+			wheel_unlink(t);
+			if (t->expires <= next) {
+				t->slot = WHEEL_FIRED;
+				wheel_push(&fired, t);
+			}
+			else
+				wheel_place(t);
+		}
+	}
+	wheelnow = now;
+}
+
+//wheelwatch callback: run the callbacks of the timers that have expired, then arm the timerfd
+//for the next tick the wheel is due. A timer re-armed or disarmed before its callback runs
+//leaves the fired list, so its callback is skipped.
+static void wheel_run(void* arg) {
+	unsigned long long expirations;
+	read(wheelwatch.fd, &expirations, sizeof(expirations));
+
+	pthread_mutex_lock(&wheelMutex);
+	wheel_advance();
+	while (fired != NULL) {
+		evloop_timer_t* t = fired;
+		wheel_unlink(t);
+		pthread_mutex_unlock(&wheelMutex);
+		if (!t->w.dead)
+			t->w.fn(t->w.arg);
+		pthread_mutex_lock(&wheelMutex);
+	}
+	wheel_arm(wheel_next());
+	pthread_mutex_unlock(&wheelMutex);
+}
+
+// Pseudocode
+// 1) Wait for events
+// 2) For every live watch run the callback: the kick eventfd runs the callbacks of newly added
+//    descriptors, and the wheel's timerfd the callbacks of the timers that expired
+// 3) Free the watches that died while the batch was handled
+//
+static void* evloop_run(void* arg) {
+	struct epoll_event events[EVLOOP_MAX_EVENTS];
+
+	while (1) {
+		int n = epoll_wait(epfd, events, EVLOOP_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("event loop: epoll_wait failed\n");
+			exit(1);
+		}
+
+		pthread_mutex_lock(&loop_mutex);
+		for (int i = 0; i < n; i++) {
+			watch_t* w = events[i].data.ptr;
+			if (w->dead)
+				continue;
+			if (w == &kickwatch) {
+				unsigned long long kicks;
+				read(kickwatch.fd, &kicks, sizeof(kicks));
+				while (kicklist != NULL) {
+					watch_t* k = kicklist;
+					kicklist = k->nextkick;
+					if (!k->dead)
+						k->fn(k->arg);
+				}
+				continue;
+			}
+			w->fn(w->arg);
+		}
+		while (deadlist != NULL) {
+			watch_t* w = deadlist;
+			deadlist = w->nextdead;
+			slab_free(watchpool, w);
+		}
+		deadnum = 0;
+		pthread_mutex_unlock(&loop_mutex);
+	}
+	return NULL;
+}
+
+static int watch_add(watch_t* w);
+
+static void evloop_init(void) {
+	watchpool = slab_create("evloop watch", sizeof(evloop_timer_t), TCB_PER_SLAB);
+	if (watchpool == NULL)
+		return;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return;
+	wheelbase = evloop_now();
+	wheelwatch.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	wheelwatch.fn = wheel_run;
+	kickwatch.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (kickwatch.fd < 0 || watch_add(&kickwatch) < 0
+			|| wheelwatch.fd < 0 || watch_add(&wheelwatch) < 0
+			|| pthread_create(&loopthread, NULL, evloop_run, NULL) != 0) {
+		close(epfd);
+		epfd = -1;
+	}
+}
+
+int evloop_start() {
+	pthread_once(&loop_once, evloop_init);
+	return epfd < 0 ? -1 : 1;
+}
+
+//take loop_mutex unless called from a callback, where the loop thread already holds it
+static int loop_lock() {
+	if (pthread_equal(pthread_self(), loopthread))
+		return 0;
+	pthread_mutex_lock(&loop_mutex);
+	return 1;
+}
+
+static void loop_unlock(int locked) {
+	if (locked)
+		pthread_mutex_unlock(&loop_mutex);
+}
+
+//allocate a zeroed watch from the pool
+static watch_t* watch_new() {
+	watch_t* w = slab_alloc(watchpool);
+	if (w != NULL)
+		memset(w, 0, sizeof(evloop_timer_t));
+	return w;
+}
+
+//queue a watch to be freed once the loop is done with its batch of events. The caller holds
+//loop_mutex. When many have piled up, kick the loop so it frees them even if it is idle.
+static void watch_kill(watch_t* w) {
+	unsigned long long kick = 1;
+	w->dead = 1;
+	w->nextdead = deadlist;
+	deadlist = w;
+	if (++deadnum == EVLOOP_MAX_EVENTS)
+		write(kickwatch.fd, &kick, sizeof(kick));
+}
+
+static int watch_add(watch_t* w) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = w;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &ev) < 0 ? -1 : 1;
+}
+
+int evloop_add_fd(int fd, evloop_fn fn, void* arg) {
+	if (evloop_start() < 0)
+		return -1;
+	watch_t* w = watch_new();
+	if (w == NULL)
+		return -1;
+	w->fd = fd;
+	w->fn = fn;
+	w->arg = arg;
+	if (watch_add(w) < 0) {
+		slab_free(watchpool, w);
+		return -1;
+	}
+
+	//run the callback once from the loop, for anything that arrived before it was added
+	unsigned long long kick = 1;
+	int locked = loop_lock();
+	w->nextkick = kicklist;
+	kicklist = w;
+	w->nextfd = fdlist;
+	fdlist = w;
+	loop_unlock(locked);
+	write(kickwatch.fd, &kick, sizeof(kick));
+	return 1;
+}
+
+void evloop_del_fd(int fd) {
+	int locked = loop_lock();
+	for (watch_t** p = &fdlist; *p != NULL; p = &(*p)->nextfd) {
+		watch_t* w = *p;
+		if (w->fd == fd) {
+			*p = w->nextfd;
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+			watch_kill(w);
+			break;
+		}
+	}
+	loop_unlock(locked);
+}
+
+evloop_timer_t* evloop_timer_new(evloop_fn fn, void* arg) {
+	if (evloop_start() < 0)
+		return NULL;
+	evloop_timer_t* timer = (evloop_timer_t*)watch_new();
+	if (timer == NULL)
+		return NULL;
+	timer->w.fd = -1;
+	timer->w.fn = fn;
+	timer->w.arg = arg;
+	return timer;
+}
+
+void evloop_timer_set(evloop_timer_t* timer, long long ns) {
+	pthread_mutex_lock(&wheelMutex);
+	wheel_unlink(timer);
+	if (ns > 0) {
+		//an idle wheel may lag far behind, start it over from the current tick
+		long long now = evloop_now() - wheelbase;
+		int idle = 1;
+		for (int level = 0; level < EVLOOP_WHEEL_LEVELS; level++)
+			idle = idle && wheelmap[level] == 0;
+		if (idle && (unsigned long long)(now / EVLOOP_TIMER_TICK) > wheelnow)
+			wheelnow = now / EVLOOP_TIMER_TICK;
+
+		//round up to a whole tick, so the timer never expires early
+		timer->expires = (now + ns + EVLOOP_TIMER_TICK - 1) / EVLOOP_TIMER_TICK;
+		if (timer->expires <= wheelnow)
+			timer->expires = wheelnow + 1;
+		wheel_place(timer);
+		unsigned long long next = wheel_next();
+		if (next < wheelarmed)
+			wheel_arm(next);
+	}
+	pthread_mutex_unlock(&wheelMutex);
+}
+
+void evloop_timer_free(evloop_timer_t* timer) {
+	if (timer == NULL)
+		return;
+	//a callback may free its own timer
+	int locked = loop_lock();
+	pthread_mutex_lock(&wheelMutex);
+	wheel_unlink(timer);
+	pthread_mutex_unlock(&wheelMutex);
+	watch_kill(&timer->w);
+	loop_unlock(locked);
+}
+
+int evloop_cond_init(pthread_cond_t* cond) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	int err = pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+	return err != 0 ? -1 : 1;
+}
+
+int evloop_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, long long ns) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += ns / 1000000000LL;
+	deadline.tv_nsec += ns % 1000000000LL;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cond, mutex, &deadline);
+}
@@ -0,0 +1,71 @@
+//
+// FILE: evloop.h
+//
+// Description: This file contains the event loop that runs the SRT client and server. One
+// thread waits in epoll_wait() for the overlay connection to become readable and for the
+// timers of every connection to expire, and runs the callback registered for each. Timers live
+// in a hierarchical timer wheel with EVLOOP_TIMER_TICK resolution, driven by a single timerfd in
+// the same epoll set: arming, moving and disarming a timer is O(1) and costs no system call
+// unless it becomes the earliest timer of the process, and no thread is ever started for it.
+//
+// Callbacks run one at a time on the loop thread and must not block on anything the loop has
+// to deliver. The blocking SRT calls sleep on condition variables that the callbacks signal,
+// see evloop_cond_init() and evloop_cond_timedwait().
+//
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <pthread.h>
+
+typedef void (*evloop_fn)(void* arg);
+typedef struct evloop_timer evloop_timer_t;
+
+// Start the loop thread. Calling it again does nothing.
+// Return 1 in case of success, and -1 in case of failure.
+//
+int evloop_start();
+
+// Run fn(arg) on the loop thread whenever fd is readable, and once as soon as the loop picks
+// the descriptor up. The callback should read until the descriptor has nothing more to give,
+// since it is called again as long as it stays readable. It may be called from a callback.
+// Return 1 in case of success, and -1 in case of failure.
+//
+int evloop_add_fd(int fd, evloop_fn fn, void* arg);
+
+// Stop watching fd. It must be called before fd is closed; once it returns the callback
+// will not run again. A callback may remove its own descriptor.
+//
+void evloop_del_fd(int fd);
+
+// Create a disarmed timer that runs fn(arg) on the loop thread when it expires.
+// Returns NULL in case of failure.
+//
+evloop_timer_t* evloop_timer_new(evloop_fn fn, void* arg);
+
+// Arm the timer to expire once, ns nanoseconds from now, replacing any earlier expiry.
+// The expiry is rounded up to the next EVLOOP_TIMER_TICK. ns = 0 disarms it. Safe to call
+// from any thread and from callbacks; a timer re-armed or disarmed after it expired but before
+// its callback ran does not run for that expiry.
+//
+void evloop_timer_set(evloop_timer_t* timer, long long ns);
+
+// Disarm and free the timer. Once it returns the callback is not running and will not run.
+//
+void evloop_timer_free(evloop_timer_t* timer);
+
+// Return the time in nanoseconds on the monotonic clock the timers use. It is read through
+// the vDSO, so it is cheap enough to timestamp every segment.
+//
+long long evloop_now();
+
+// Initialize a condition variable whose timed waits use the monotonic clock.
+// Return 1 in case of success, and -1 in case of failure.
+//
+int evloop_cond_init(pthread_cond_t* cond);
+
+// Wait on cond for at most ns nanoseconds. Returns 0 when signaled and ETIMEDOUT on timeout.
+//
+int evloop_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, long long ns);
+
+#endif
@@ -0,0 +1,186 @@
+//FILE: common/impair.c
+//
+//Description: impairment model applied to received segments: loss, corruption,
+//duplication and Gilbert-Elliott burst loss driven by a seeded xoshiro256** generator
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "impair.h"
+
+//splitmix64 step, used to expand the seed into the generator state
+static unsigned long long splitmix64(unsigned long long* x) {
+	unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned long long rotl(unsigned long long x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+//xoshiro256** next output
+static unsigned long long rng_next(impair_t* im) {
+	unsigned long long* s = im->rng;
+	unsigned long long result = rotl(s[1] * 5, 7) * 9;
+	unsigned long long t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+//uniform double in [0, 1)
+static double rng_uniform(impair_t* im) {
+	return (rng_next(im) >> 11) * 0x1.0p-53;
+}
+
+static void rng_seed(impair_t* im, unsigned long long seed) {
+	for (int i = 0; i < 4; i++)
+		im->rng[i] = splitmix64(&seed);
+}
+
+void impair_default(impair_cfg_t* cfg) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	memset(cfg, 0, sizeof(impair_cfg_t));
+	cfg->enabled = 1;
+	cfg->loss = PKT_LOSS_RATE / 2;
+	cfg->corrupt = PKT_LOSS_RATE / 2;
+	cfg->ge_loss = 1.0;
+	cfg->seed = now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//parse a probability in [0, 1]
+static int parse_prob(const char* str, char** end, double* out) {
+	double v = strtod(str, end);
+	if (*end == str || v < 0 || v > 1)
+		return -1;
+	*out = v;
+	return 1;
+}
+
+int impair_parse(impair_cfg_t* cfg, const char* spec) {
+	impair_cfg_t tmp = *cfg;
+	const char* p = spec;
+	char* end;
+
+	if (strcmp(spec, "off") == 0) {
+		cfg->enabled = 0;
+		return 1;
+	}
+
+	tmp.enabled = 1;
+	while (*p != '\0') {
+		const char* eq = strchr(p, '=');
+		if (eq == NULL)
+			return -1;
+		size_t keylen = eq - p;
+		const char* val = eq + 1;
+
+		if (keylen == 4 && strncmp(p, "loss", 4) == 0) {
+			if (parse_prob(val, &end, &tmp.loss) < 0)
+				return -1;
+		}
+		else if (keylen == 7 && strncmp(p, "corrupt", 7) == 0) {
+			if (parse_prob(val, &end, &tmp.corrupt) < 0)
+				return -1;
+		}
+		else if (keylen == 3 && strncmp(p, "dup", 3) == 0) {
+			if (parse_prob(val, &end, &tmp.dup) < 0)
+				return -1;
+		}
+		else if (keylen == 4 && strncmp(p, "seed", 4) == 0) {
+			tmp.seed = strtoull(val, &end, 0);
+			if (end == val)
+				return -1;
+		}
+		else if (keylen == 2 && strncmp(p, "ge", 2) == 0) {
+			if (parse_prob(val, &end, &tmp.ge_p) < 0 || *end != ':')
+				return -1;
+			if (parse_prob(end + 1, &end, &tmp.ge_r) < 0 || *end != ':')
+				return -1;
+			if (parse_prob(end + 1, &end, &tmp.ge_loss) < 0)
+				return -1;
+		}
+		else {
+			return -1;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return -1;
+		p = end;
+	}
+
+	*cfg = tmp;
+	return 1;
+}
+
+void impair_init(impair_t* im, const impair_cfg_t* cfg) {
+	pthread_mutex_init(&im->lock, NULL);
+	im->cfg = *cfg;
+	im->bad = 0;
+	rng_seed(im, cfg->seed);
+}
+
+void impair_config(impair_t* im, const impair_cfg_t* cfg) {
+	pthread_mutex_lock(&im->lock);
+	im->cfg = *cfg;
+	im->bad = 0;
+	rng_seed(im, cfg->seed);
+	pthread_mutex_unlock(&im->lock);
+}
+
+// Pseudocode
+// 1) If the model is off, pass the segment
+// 2) Step the Gilbert-Elliott channel and draw loss with the current state's rate
+// 3) If the segment survives, maybe flip a random bit, then maybe duplicate it
+//
+int impair_apply(impair_t* im, seg_t* segPtr, int* corrupted) {
+	*corrupted = 0;
+	if (!im->cfg.enabled)
+		return IMPAIR_PASS;
+
+	pthread_mutex_lock(&im->lock);
+	double loss = im->cfg.loss;
+	if (im->cfg.ge_p > 0) {
+		if (im->bad) {
+			if (rng_uniform(im) < im->cfg.ge_r)
+				im->bad = 0;
+		}
+		else if (rng_uniform(im) < im->cfg.ge_p) {
+			im->bad = 1;
+		}
+		if (im->bad)
+			loss = im->cfg.ge_loss;
+	}
+
+	if (rng_uniform(im) < loss) {
+		pthread_mutex_unlock(&im->lock);
+		return IMPAIR_DROP;
+	}
+
+	if (rng_uniform(im) < im->cfg.corrupt) {
+		//flip a random bit of the header or data
+		unsigned int len = sizeof(srt_hdr_t) + segPtr->header.length;
+		unsigned int errorbit = rng_next(im) % (len * 8);
+		char* temp = (char*)segPtr + errorbit / 8;
+		*temp = *temp ^ (1 << (errorbit % 8));
+		*corrupted = 1;
+	}
+
+	int result = IMPAIR_PASS;
+	if (rng_uniform(im) < im->cfg.dup)
+		result = IMPAIR_DUP;
+	pthread_mutex_unlock(&im->lock);
+	return result;
+}
@@ -0,0 +1,67 @@
+//
+// FILE: impair.h
+//
+// Description: This file contains the impairment model snp_recvseg() applies to received
+// segments to emulate an unreliable network: segment loss, bit corruption, duplication and
+// bursty loss following a Gilbert-Elliott model. Every overlay connection has its own model
+// with its own seeded random number generator, so a loss pattern can be reproduced exactly.
+//
+
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <pthread.h>
+#include "seg.h"
+
+//results of impair_apply()
+#define IMPAIR_PASS 0           //deliver the segment
+#define IMPAIR_DROP 1           //the segment is lost
+#define IMPAIR_DUP 2            //deliver the segment twice
+
+//impairment model configuration
+typedef struct impair_cfg {
+	int enabled;                //0 turns the model off, every segment passes untouched
+	double loss;                //probability a segment is lost (in the good state)
+	double corrupt;             //probability a bit of a delivered segment is flipped
+	double dup;                 //probability a delivered segment is duplicated
+	double ge_p;                //Gilbert-Elliott good to bad transition probability, 0 disables bursts
+	double ge_r;                //Gilbert-Elliott bad to good transition probability
+	double ge_loss;             //probability a segment is lost in the bad state
+	unsigned long long seed;    //random number generator seed
+} impair_cfg_t;
+
+//per-connection impairment state
+typedef struct impair {
+	impair_cfg_t cfg;
+	unsigned long long rng[4];  //xoshiro256** state
+	int bad;                    //Gilbert-Elliott channel is in the bad state
+	pthread_mutex_t lock;       //guards the state against a concurrent reconfiguration
+} impair_t;
+
+// Fill cfg with the default model: PKT_LOSS_RATE split evenly between loss and corruption,
+// as seglost() always did, seeded from the clock.
+//
+void impair_default(impair_cfg_t* cfg);
+
+// Parse a specification such as ``loss=0.02,corrupt=0.01,dup=0.001,seed=42,ge=0.01:0.3:0.5''
+// into cfg. Fields that are not named keep their current value. ``ge=p:r:h'' sets the
+// Gilbert-Elliott transition probabilities and the bad state loss rate; ``off'' disables the
+// model. Return 1 in case of success, and -1 if the specification is malformed.
+//
+int impair_parse(impair_cfg_t* cfg, const char* spec);
+
+// Initialize the impairment state with cfg and seed its random number generator.
+//
+void impair_init(impair_t* im, const impair_cfg_t* cfg);
+
+// Replace the configuration and reseed the generator of an initialized impairment state.
+//
+void impair_config(impair_t* im, const impair_cfg_t* cfg);
+
+// Decide the fate of a received segment. A corrupted segment has one random bit of its header
+// or data flipped and is still delivered, so the checksum check discards it.
+// Returns IMPAIR_PASS, IMPAIR_DROP or IMPAIR_DUP. *corrupted is set to 1 if a bit was flipped.
+//
+int impair_apply(impair_t* im, seg_t* segPtr, int* corrupted);
+
+#endif
@@ -4,11 +4,19 @@
 //
 //Date: April 18,2008
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <pthread.h>
 #include "seg.h"
+#include "impair.h"
+#include "snp_shm.h"
+#include "snp_uring.h"
 
 //states used by snp_recvseg()
 // START1 starting point 
@@ -20,6 +28,373 @@
 #define RECV 2
 #define STOP1 3
 
+//bytes of framing around every segment on the overlay: "!&" before and "!#" after
+#define FRAME_START_LEN 2
+#define FRAME_END_LEN 2
+
+//the counters are shared between the threads that send on a connection
+#define SNP_STAT_ADD(conn, field, n) __atomic_fetch_add(&(conn)->stats.field, (n), __ATOMIC_RELAXED)
+
+//per-connection SNP state. The table is indexed by overlay socket descriptor and
+//an entry is created the first time a connection is used.
+typedef struct snp_conn {
+	int overlay;                //SNP_OVERLAY_STREAM or SNP_OVERLAY_DGRAM
+	int framing;                //SNP_FRAMING_DELIM or SNP_FRAMING_LENGTH
+	int dstate;                 //SNP_FRAMING_DELIM: parser state, kept between calls
+	int didx;                   //SNP_FRAMING_DELIM: bytes collected in dbuf
+	char dbuf[SEG_SIZE(JUMBO_SEG_LEN)+2]; //SNP_FRAMING_DELIM: segment being collected
+	char* rxbuf;                //receive ring of SNP_RXBUF_SIZE bytes
+	unsigned int rxhead;        //ring read cursor, free running
+	unsigned int rxtail;        //ring write cursor, free running
+	char* dgslots;              //datagram overlay: segments received by the last recvmmsg(), see DGRAM_SLOT()
+	unsigned int dglen[SNP_MAX_BATCH]; //datagram overlay: length of each received datagram
+	int dgnext;                 //datagram overlay: next slot to hand out
+	int dgcount;                //datagram overlay: number of filled slots
+	shm_overlay_t* shm;         //shared memory overlay rings
+	uring_engine_t* uring;      //io_uring engine of a stream overlay, NULL for plain syscalls
+	pthread_mutex_t txmutex;    //serializes senders so frames do not interleave
+	impair_t impair;            //impairment model applied to received segments
+	int duppending;             //dupseg must be delivered by the next snp_recvseg()
+	SEGBUF(JUMBO_SEG_LEN) dupseg; //copy of the last segment the impairment model duplicated
+	snp_stats_t stats;
+} snp_conn_t;
+
+//slot i of the datagram batch, each has room for the largest segment
+#define DGRAM_SLOT(conn, i) ((seg_t*)((conn)->dgslots + (i) * SEG_SIZE(JUMBO_SEG_LEN)))
+
+static snp_conn_t* snpconn[SNP_MAX_CONN];
+static pthread_mutex_t snpconn_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int seglost(snp_conn_t* conn, seg_t* segPtr);
+
+// Find the SNP state of an overlay connection, creating it on first use.
+// Returns NULL if the descriptor is out of range or memory is exhausted.
+static snp_conn_t* snp_getconn(int connection) {
+	if (connection < 0 || connection >= SNP_MAX_CONN)
+		return NULL;
+	snp_conn_t* conn = __atomic_load_n(&snpconn[connection], __ATOMIC_ACQUIRE);
+	if (conn != NULL)
+		return conn;
+
+	pthread_mutex_lock(&snpconn_mutex);
+	conn = snpconn[connection];
+	if (conn == NULL) {
+		conn = calloc(1, sizeof(snp_conn_t));
+		if (conn != NULL) {
+			conn->rxbuf = malloc(SNP_RXBUF_SIZE);
+			if (conn->rxbuf == NULL) {
+				free(conn);
+				conn = NULL;
+			}
+		}
+		if (conn != NULL) {
+			//datagram sockets carry one segment per datagram without delimiters
+			int type;
+			socklen_t typelen = sizeof(type);
+			conn->overlay = SNP_OVERLAY_STREAM;
+			if (getsockopt(connection, SOL_SOCKET, SO_TYPE, &type, &typelen) == 0 && type == SOCK_DGRAM) {
+				conn->overlay = SNP_OVERLAY_DGRAM;
+				conn->dgslots = malloc(SNP_MAX_BATCH * SEG_SIZE(JUMBO_SEG_LEN));
+				if (conn->dgslots == NULL) {
+					free(conn->rxbuf);
+					free(conn);
+					pthread_mutex_unlock(&snpconn_mutex);
+					return NULL;
+				}
+			}
+			pthread_mutex_init(&conn->txmutex, NULL);
+
+			impair_cfg_t cfg;
+			impair_default(&cfg);
+			cfg.seed += connection;
+			char* spec = getenv("SNP_IMPAIR");
+			if (spec != NULL && impair_parse(&cfg, spec) < 0)
+				printf("SNP_IMPAIR: bad specification %s, using the default\n", spec);
+			impair_init(&conn->impair, &cfg);
+
+			char* engine = getenv("SNP_ENGINE");
+			if (engine != NULL && strcmp(engine, "uring") == 0 && conn->overlay == SNP_OVERLAY_STREAM) {
+				conn->uring = uring_engine_create(connection);
+				if (conn->uring == NULL)
+					printf("SNP_ENGINE: io_uring is unavailable, using plain syscalls\n");
+			}
+
+			conn->framing = SNP_DEFAULT_FRAMING;
+			char* mode = getenv("SNP_FRAMING");
+			if (mode != NULL && strcmp(mode, "delim") == 0)
+				conn->framing = SNP_FRAMING_DELIM;
+			else if (mode != NULL && strcmp(mode, "length") == 0)
+				conn->framing = SNP_FRAMING_LENGTH;
+			__atomic_store_n(&snpconn[connection], conn, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&snpconn_mutex);
+	return conn;
+}
+
+void snp_release(int connection) {
+	if (connection < 0 || connection >= SNP_MAX_CONN)
+		return;
+	pthread_mutex_lock(&snpconn_mutex);
+	snp_conn_t* conn = snpconn[connection];
+	__atomic_store_n(&snpconn[connection], NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&snpconn_mutex);
+	if (conn == NULL)
+		return;
+	uring_engine_destroy(conn->uring);
+	shm_overlay_destroy(conn->shm);
+	pthread_mutex_destroy(&conn->txmutex);
+	free(conn->dgslots);
+	free(conn->rxbuf);
+	free(conn);
+}
+
+int snp_setframing(int connection, int mode) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL || (mode != SNP_FRAMING_DELIM && mode != SNP_FRAMING_LENGTH))
+		return -1;
+	conn->framing = mode;
+	return 1;
+}
+
+int snp_shm_start(int connection, int creator) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL || conn->overlay != SNP_OVERLAY_STREAM)
+		return -1;
+	//the rings replace the overlay I/O, so the engine is not needed any more
+	uring_engine_destroy(conn->uring);
+	conn->uring = NULL;
+	conn->shm = creator ? shm_overlay_create(connection) : shm_overlay_attach(connection);
+	if (conn->shm == NULL)
+		return -1;
+	conn->overlay = SNP_OVERLAY_SHM;
+	return 1;
+}
+
+int snp_setengine(int connection, int engine) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL || (engine != SNP_ENGINE_SYSCALL && engine != SNP_ENGINE_URING))
+		return -1;
+	if (engine == SNP_ENGINE_SYSCALL) {
+		uring_engine_destroy(conn->uring);
+		conn->uring = NULL;
+		return 1;
+	}
+	if (conn->overlay != SNP_OVERLAY_STREAM)
+		return -1;
+	if (conn->uring == NULL)
+		conn->uring = uring_engine_create(connection);
+	return conn->uring != NULL ? 1 : -1;
+}
+
+int snp_getengine(int connection) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL)
+		return -1;
+	return conn->uring != NULL ? SNP_ENGINE_URING : SNP_ENGINE_SYSCALL;
+}
+
+int snp_getoverlay(int connection) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL)
+		return -1;
+	return conn->overlay;
+}
+
+int snp_getmaxseg(int connection) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL)
+		return -1;
+	return conn->overlay == SNP_OVERLAY_SHM ? MAX_SEG_LEN : JUMBO_SEG_LEN;
+}
+
+int snp_setimpair(int connection, const impair_cfg_t* cfg) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL)
+		return -1;
+	impair_config(&conn->impair, cfg);
+	return 1;
+}
+
+int snp_getstats(int connection, snp_stats_t* stats) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL)
+		return -1;
+	stats->rx_syscalls = __atomic_load_n(&conn->stats.rx_syscalls, __ATOMIC_RELAXED);
+	stats->rx_segs = __atomic_load_n(&conn->stats.rx_segs, __ATOMIC_RELAXED);
+	stats->rx_bytes = __atomic_load_n(&conn->stats.rx_bytes, __ATOMIC_RELAXED);
+	stats->rx_lost = __atomic_load_n(&conn->stats.rx_lost, __ATOMIC_RELAXED);
+	stats->rx_corrupted = __atomic_load_n(&conn->stats.rx_corrupted, __ATOMIC_RELAXED);
+	stats->rx_duplicated = __atomic_load_n(&conn->stats.rx_duplicated, __ATOMIC_RELAXED);
+	stats->rx_badsum = __atomic_load_n(&conn->stats.rx_badsum, __ATOMIC_RELAXED);
+	stats->tx_syscalls = __atomic_load_n(&conn->stats.tx_syscalls, __ATOMIC_RELAXED);
+	stats->tx_segs = __atomic_load_n(&conn->stats.tx_segs, __ATOMIC_RELAXED);
+	stats->tx_bytes = __atomic_load_n(&conn->stats.tx_bytes, __ATOMIC_RELAXED);
+	return 1;
+}
+
+// Write the whole iovec array to the overlay, continuing after partial writes.
+// Returns 1 in case of success, and -1 in case of failure.
+static int tx_sendmsg(int connection, snp_conn_t* conn, struct iovec* iov, int iovcnt) {
+	struct msghdr msg;
+
+	if (conn->uring != NULL) {
+		unsigned long syscalls = 0;
+		long n = uring_engine_writev(conn->uring, iov, iovcnt, &syscalls);
+		SNP_STAT_ADD(conn, tx_syscalls, syscalls);
+		if (n < 0)
+			return -1;
+		SNP_STAT_ADD(conn, tx_bytes, n);
+		return 1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	while (iovcnt > 0) {
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ssize_t n = sendmsg(connection, &msg, 0);
+		SNP_STAT_ADD(conn, tx_syscalls, 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		SNP_STAT_ADD(conn, tx_bytes, n);
+
+		//skip the iovecs that were written completely
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 1;
+}
+
+// Point iov at the bytes of a segment: the header and data of seg, or the header of seg and
+// the data at ext when the data lives outside the segment.
+// Returns the number of iovecs used.
+static int tx_segiov(struct iovec* iov, seg_t* seg, const char* ext) {
+	if (ext == NULL) {
+		iov[0].iov_base = seg;
+		iov[0].iov_len = sizeof(srt_hdr_t) + seg->header.length;
+		return 1;
+	}
+	iov[0].iov_base = &seg->header;
+	iov[0].iov_len = sizeof(srt_hdr_t);
+	iov[1].iov_base = (void*)ext;
+	iov[1].iov_len = seg->header.length;
+	return 2;
+}
+
+// Send segments through a datagram overlay, one segment per datagram, with one
+// sendmmsg() for every SNP_MAX_BATCH segments.
+// Returns 1 in case of success, and -1 in case of failure.
+static int tx_dgram(int connection, snp_conn_t* conn, seg_t** segs, const char** data, int n) {
+	struct mmsghdr msgs[SNP_MAX_BATCH];
+	struct iovec iov[2 * SNP_MAX_BATCH];
+
+	while (n > 0) {
+		int batch = n < SNP_MAX_BATCH ? n : SNP_MAX_BATCH;
+		memset(msgs, 0, batch * sizeof(struct mmsghdr));
+		for (int i = 0; i < batch; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov[2*i];
+			msgs[i].msg_hdr.msg_iovlen = tx_segiov(&iov[2*i], segs[i], data != NULL ? data[i] : NULL);
+		}
+
+		int sent = 0;
+		while (sent < batch) {
+			int r = sendmmsg(connection, msgs + sent, batch - sent, 0);
+			SNP_STAT_ADD(conn, tx_syscalls, 1);
+			if (r < 0) {
+				//a refused earlier datagram is reported here; the network lost it
+				if (errno == EINTR || errno == ECONNREFUSED)
+					continue;
+				return -1;
+			}
+			for (int i = sent; i < sent + r; i++)
+				SNP_STAT_ADD(conn, tx_bytes, msgs[i].msg_len);
+			sent += r;
+		}
+		SNP_STAT_ADD(conn, tx_segs, batch);
+		segs += batch;
+		if (data != NULL)
+			data += batch;
+		n -= batch;
+	}
+	return 1;
+}
+
+// Send segments through overlay TCP
+// each in form of !&segment!#
+//
+// the segments must already carry their checksum, so retransmissions do not recompute it
+//
+// Pseudocode
+// 1) gather '!&', the segment header and data and '!#' of up to SNP_MAX_BATCH segments
+//    into an iovec array, taking the data from data[i] when it is given
+// 2) write the array with one sendmsg()
+//
+int snp_sendseg_gather(int connection, seg_t** segs, const char** data, int n) {
+	static char bufstart[2] = "!&";
+	static char bufend[2] = "!#";
+	struct iovec iov[4 * SNP_MAX_BATCH];
+
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&conn->txmutex);
+	if (conn->overlay == SNP_OVERLAY_DGRAM) {
+		int r = tx_dgram(connection, conn, segs, data, n);
+		pthread_mutex_unlock(&conn->txmutex);
+		return r;
+	}
+	if (conn->overlay == SNP_OVERLAY_SHM) {
+		unsigned long syscalls = 0;
+		int r = shm_overlay_push(conn->shm, connection, segs, data, n, &syscalls);
+		SNP_STAT_ADD(conn, tx_syscalls, syscalls);
+		if (r > 0) {
+			SNP_STAT_ADD(conn, tx_segs, n);
+			for (int i = 0; i < n; i++)
+				SNP_STAT_ADD(conn, tx_bytes, sizeof(srt_hdr_t) + segs[i]->header.length);
+		}
+		pthread_mutex_unlock(&conn->txmutex);
+		return r;
+	}
+	while (n > 0) {
+		int batch = n < SNP_MAX_BATCH ? n : SNP_MAX_BATCH;
+		int iovcnt = 0;
+		for (int i = 0; i < batch; i++) {
+			iov[iovcnt].iov_base = bufstart;
+			iov[iovcnt++].iov_len = FRAME_START_LEN;
+			iovcnt += tx_segiov(&iov[iovcnt], segs[i], data != NULL ? data[i] : NULL);
+			iov[iovcnt].iov_base = bufend;
+			iov[iovcnt++].iov_len = FRAME_END_LEN;
+		}
+		if (tx_sendmsg(connection, conn, iov, iovcnt) < 0) {
+			pthread_mutex_unlock(&conn->txmutex);
+			return -1;
+		}
+		SNP_STAT_ADD(conn, tx_segs, batch);
+		segs += batch;
+		if (data != NULL)
+			data += batch;
+		n -= batch;
+	}
+	pthread_mutex_unlock(&conn->txmutex);
+	return 1;
+}
+
+int snp_sendseg_batch(int connection, seg_t** segs, int n) {
+	return snp_sendseg_gather(connection, segs, NULL, n);
+}
+
 // Send a segment through overlay TCP
 // in form of !&segment!#  
 // 
@@ -27,22 +402,17 @@
 // 1) send '!&' first
 // 2) then send the segment
 // 3) finally send '!#'
+// all three go out in a single sendmsg() through snp_sendseg_batch()
 //
 int snp_sendseg(int connection, seg_t* segPtr) {
 	segPtr->header.checksum = checksum(segPtr);
-	char bufstart[2] = "!&";
-	char bufend[2] = "!#";
-	if (send(connection, bufstart, 2, 0) < 0) {
-		return -1;
-	}
-	int segsize = sizeof(srt_hdr_t) + segPtr->header.length;
-	if(send(connection,segPtr,segsize,0)<0) {
-		return -1;
-	}
-	if(send(connection,bufend,2,0)<0) {
-		return -1;
-	}
-	return 1;
+	return snp_sendseg_batch(connection, &segPtr, 1);
+}
+
+//keep a copy of a segment the impairment model duplicated for the next snp_recvseg()
+static void rx_keepdup(snp_conn_t* conn, seg_t* segPtr) {
+	memcpy(&conn->dupseg.seg, segPtr, sizeof(srt_hdr_t) + segPtr->header.length);
+	conn->duppending = 1;
 }
 
 // receive a segment from overlay TCP connection
@@ -53,111 +423,640 @@ int snp_sendseg(int connection, seg_t* segPtr) {
 // STOP1 -- '!' received, expecting '#' to finish receiving segment
 // when a segment is received, use seglost to determine if the segment should bediscarded 
 //
+// the parser state lives in the connection, so a nonblocking call that runs out of bytes
+// in the middle of a segment picks up where it stopped
+//
 // Pseudocode
 // 1) While recv(connection,&c,1,)
 //      Based on value of c jump between states described above
 //      When we get a segment use checkchecksum to verify integrity
 //
-int snp_recvseg(int connection, seg_t* segPtr) {
-	char buf[sizeof(seg_t)+2]; 
+static int snp_recvseg_delim(int connection, snp_conn_t* conn, seg_t* segPtr, int flags) {
+	char* buf = conn->dbuf;
 	char c;
-	int idx = 0;
+	int r;
 
-	int state = START1; 
-	while(recv(connection,&c,1,0)>0) {
-		switch(state) {
+	while((r = recv(connection,&c,1,flags))>0) {
+		SNP_STAT_ADD(conn, rx_syscalls, 1);
+		SNP_STAT_ADD(conn, rx_bytes, 1);
+		switch(conn->dstate) {
 			case START1:
  				if(c=='!')
-				state = START2;
+				conn->dstate = START2;
 				break;
 			case START2:
 				if(c=='&') 
-					state = RECV;
+					conn->dstate = RECV;
 				else
-					state = START1;
+					conn->dstate = START1;
 				break;
 			case RECV:
 				if(c=='!') {
-					buf[idx]=c;
-					idx++;
-					state = STOP1;
+					buf[conn->didx]=c;
+					conn->didx++;
+					conn->dstate = STOP1;
 				}
 				else {
-					buf[idx]=c;
-					idx++;
+					buf[conn->didx]=c;
+					conn->didx++;
 				}
 				break;
 			case STOP1:
 				if(c=='#') {
-					buf[idx]=c;
-					memcpy(segPtr,buf,idx-1);
+					buf[conn->didx]=c;
+					memcpy(segPtr,buf,conn->didx-1);
 
-					state = START1;
-					idx = 0;
-				
+					conn->dstate = START1;
+					conn->didx = 0;
+					SNP_STAT_ADD(conn, rx_segs, 1);
 
 					//add segment error	
-					if(seglost(segPtr)>0) {
+					int fate = seglost(conn, segPtr);
+					if(fate == IMPAIR_DROP) {
 						continue;	
 				         }
 
 					if(checkchecksum(segPtr)<0) {
 						printf("checksum error,drop!\n");
+						SNP_STAT_ADD(conn, rx_badsum, 1);
 						continue;
 					}
+					if(fate == IMPAIR_DUP) {
+						rx_keepdup(conn, segPtr);
+					}
 					return 1;
 				}
 				else if(c=='!') {
-					buf[idx]=c;
-					idx++;
+					buf[conn->didx]=c;
+					conn->didx++;
 				}
 				else {
-					buf[idx]=c;
-					idx++;	
-					state = RECV;
+					buf[conn->didx]=c;
+					conn->didx++;	
+					conn->dstate = RECV;
 				}
 				break;
 			default:
 				break;
 	
 		}
+		//no end marker within a segment's length, the bytes were not a frame
+		if(conn->didx >= (int)sizeof(conn->dbuf)) {
+			conn->dstate = START1;
+			conn->didx = 0;
+		}
 	}
+	if(r<0 && (flags & MSG_DONTWAIT) && (errno==EAGAIN || errno==EWOULDBLOCK))
+		return 0;
 	return -1;
 }
 
-//lost rate is PKT_LOSS_RATE defined in constant.h
-//if a segment has is lost, return 1; otherwise return 0 
-//PKT_LOSS_RATE/2 probability of segment loss
-//PKT_LOSS_RATE/2 probability of invalid checksum
-//
-// Pseudocode
-// 1) Randomly decide whether to mess with this segment
-// 2) If so, flip a coin, if heads seglost, if tails
-//    flip a bit and return the result
-//
-int seglost(seg_t* segPtr) {
-	int random = rand()%100;
-	if(random<PKT_LOSS_RATE*100) {
-		//50% probability of losing a segment
-		if(rand()%2==0) {
-			printf("seg lost!!!\n");
-                        return 1;
-		}
-		//50% chance of invalid checksum
-		else {
-			//get data length
-			int len = sizeof(srt_hdr_t)+segPtr->header.length;
-			//get a random bit that will be fliped
-			int errorbit = rand()%(len*8);
-			//flip the bit
-			char* temp = (char*)segPtr;
-			temp = temp + errorbit/8;
-			*temp = *temp^(1<<(errorbit%8));
+//byte at offset off from the read cursor of the receive ring
+static char rx_byte(snp_conn_t* conn, unsigned int off) {
+	return conn->rxbuf[(conn->rxhead + off) & (SNP_RXBUF_SIZE - 1)];
+}
+
+//copy len bytes starting at offset off from the read cursor out of the receive ring
+static void rx_copyout(snp_conn_t* conn, unsigned int off, void* dst, unsigned int len) {
+	unsigned int pos = (conn->rxhead + off) & (SNP_RXBUF_SIZE - 1);
+	unsigned int first = SNP_RXBUF_SIZE - pos;
+	if (first >= len) {
+		memcpy(dst, conn->rxbuf + pos, len);
+	}
+	else {
+		memcpy(dst, conn->rxbuf + pos, first);
+		memcpy((char*)dst + first, conn->rxbuf, len - first);
+	}
+}
+
+// Read as much as the overlay has ready into the free space of the receive ring with a
+// single recvmsg(), or from the completions of the io_uring engine when the connection has one.
+// With MSG_DONTWAIT in flags it fails with EAGAIN instead of waiting for data.
+// Returns the number of bytes read, 0 on end of stream and -1 on error.
+static int rx_fill(int connection, snp_conn_t* conn, int flags) {
+	unsigned int used = conn->rxtail - conn->rxhead;
+	unsigned int pos = conn->rxtail & (SNP_RXBUF_SIZE - 1);
+	unsigned int space = SNP_RXBUF_SIZE - used;
+	struct iovec iov[2];
+	int iovcnt = 1;
+
+	iov[0].iov_base = conn->rxbuf + pos;
+	if (pos + space <= SNP_RXBUF_SIZE) {
+		iov[0].iov_len = space;
+	}
+	else {
+		iov[0].iov_len = SNP_RXBUF_SIZE - pos;
+		iov[1].iov_base = conn->rxbuf;
+		iov[1].iov_len = space - iov[0].iov_len;
+		iovcnt = 2;
+	}
+
+	ssize_t n;
+	if (conn->uring != NULL) {
+		unsigned long syscalls = 0;
+		n = uring_engine_readv(conn->uring, iov, iovcnt, flags & MSG_DONTWAIT, &syscalls);
+		SNP_STAT_ADD(conn, rx_syscalls, syscalls);
+	}
+	else {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		n = recvmsg(connection, &msg, flags);
+		SNP_STAT_ADD(conn, rx_syscalls, 1);
+	}
+	if (n > 0) {
+		conn->rxtail += n;
+		SNP_STAT_ADD(conn, rx_bytes, n);
+	}
+	return n;
+}
+
+// Extract the next complete segment from the receive ring into segPtr.
+// A frame is "!&", a header, header.length data bytes and "!#". Anything that does not
+// form such a frame is skipped one byte at a time until the next "!&".
+// Returns 1 if a segment was extracted and 0 if the ring needs more data.
+static int rx_parse(snp_conn_t* conn, seg_t* segPtr) {
+	while (1) {
+		unsigned int avail = conn->rxtail - conn->rxhead;
+
+		//look for the start of a frame
+		while (avail >= FRAME_START_LEN && (rx_byte(conn, 0) != '!' || rx_byte(conn, 1) != '&')) {
+			conn->rxhead++;
+			avail--;
+		}
+		if (avail < FRAME_START_LEN + sizeof(srt_hdr_t))
+			return 0;
+
+		rx_copyout(conn, FRAME_START_LEN, &segPtr->header, sizeof(srt_hdr_t));
+		unsigned int len = segPtr->header.length;
+		if (len > JUMBO_SEG_LEN) {
+			conn->rxhead++;
+			continue;
+		}
+
+		unsigned int total = FRAME_START_LEN + sizeof(srt_hdr_t) + len + FRAME_END_LEN;
+		if (avail < total)
+			return 0;
+		if (rx_byte(conn, total - 2) != '!' || rx_byte(conn, total - 1) != '#') {
+			conn->rxhead++;
+			continue;
+		}
+
+		rx_copyout(conn, FRAME_START_LEN + sizeof(srt_hdr_t), segPtr->data, len);
+		conn->rxhead += total;
+		return 1;
+	}
+}
+
+int snp_recvready(int connection) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL) {
+		return 0;
+	}
+	if (conn->overlay == SNP_OVERLAY_DGRAM) {
+		return conn->dgnext < conn->dgcount;
+	}
+	if (conn->overlay == SNP_OVERLAY_SHM) {
+		return shm_overlay_ready(conn->shm);
+	}
+	if (conn->framing == SNP_FRAMING_DELIM) {
+		return 0;
+	}
+
+	//walk the frames in the ring without consuming them
+	unsigned int off = 0;
+	unsigned int avail = conn->rxtail - conn->rxhead;
+	while (avail - off >= FRAME_START_LEN + sizeof(srt_hdr_t)) {
+		if (rx_byte(conn, off) != '!' || rx_byte(conn, off + 1) != '&') {
+			off++;
+			continue;
+		}
+		srt_hdr_t header;
+		rx_copyout(conn, off + FRAME_START_LEN, &header, sizeof(srt_hdr_t));
+		unsigned int total = FRAME_START_LEN + sizeof(srt_hdr_t) + header.length + FRAME_END_LEN;
+		if (header.length > JUMBO_SEG_LEN) {
+			off++;
+			continue;
+		}
+		if (avail - off < total) {
 			return 0;
 		}
+		if (rx_byte(conn, off + total - 2) == '!' && rx_byte(conn, off + total - 1) == '#') {
+			return 1;
+		}
+		off++;
 	}
 	return 0;
+}
+
+// Take the next datagram of the last recvmmsg() batch, receiving a new batch when it is used up.
+// Datagrams whose size does not match their header length are discarded.
+// Returns 1 if a segment was copied into segPtr, 0 if flags has MSG_DONTWAIT and no datagram
+// is waiting, and -1 on error.
+static int rx_dgram(int connection, snp_conn_t* conn, seg_t* segPtr, int flags) {
+	struct mmsghdr msgs[SNP_MAX_BATCH];
+	struct iovec iov[SNP_MAX_BATCH];
+
+	while (1) {
+		while (conn->dgnext < conn->dgcount) {
+			int i = conn->dgnext++;
+			seg_t* slot = DGRAM_SLOT(conn, i);
+			if (conn->dglen[i] < sizeof(srt_hdr_t) || slot->header.length != conn->dglen[i] - sizeof(srt_hdr_t)) {
+				continue;
+			}
+			memcpy(segPtr, slot, conn->dglen[i]);
+			return 1;
+		}
+
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < SNP_MAX_BATCH; i++) {
+			iov[i].iov_base = DGRAM_SLOT(conn, i);
+			iov[i].iov_len = SEG_SIZE(JUMBO_SEG_LEN);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(connection, msgs, SNP_MAX_BATCH, flags ? flags : MSG_WAITFORONE, NULL);
+		SNP_STAT_ADD(conn, rx_syscalls, 1);
+		if (n < 0) {
+			if (errno == EINTR || errno == ECONNREFUSED)
+				continue;
+			if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return 0;
+			return -1;
+		}
+		for (int i = 0; i < n; i++) {
+			conn->dglen[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;
+			SNP_STAT_ADD(conn, rx_bytes, msgs[i].msg_len);
+		}
+		conn->dgnext = 0;
+		conn->dgcount = n;
+	}
+}
+
+// Get the next segment from the overlay into segPtr: from the datagram batch on a datagram
+// overlay, from the incoming ring on a shared memory overlay, or by length framing out of
+// the receive ring on a stream overlay. With MSG_DONTWAIT in flags it returns instead of
+// waiting for the overlay.
+// Returns 1 if a segment was copied into segPtr, 0 if none is ready without waiting, and -1
+// when the overlay fails or closes.
+static int rx_next(int connection, snp_conn_t* conn, seg_t* segPtr, int flags) {
+	if (conn->overlay == SNP_OVERLAY_DGRAM) {
+		return rx_dgram(connection, conn, segPtr, flags);
+	}
+	if (conn->overlay == SNP_OVERLAY_SHM) {
+		unsigned long syscalls = 0;
+		int r = shm_overlay_pop(conn->shm, connection, segPtr, flags & MSG_DONTWAIT, &syscalls);
+		SNP_STAT_ADD(conn, rx_syscalls, syscalls);
+		if (r > 0)
+			SNP_STAT_ADD(conn, rx_bytes, sizeof(srt_hdr_t) + segPtr->header.length);
+		return r;
+	}
+	while (!rx_parse(conn, segPtr)) {
+		int n = rx_fill(connection, conn, flags);
+		if (n < 0 && (flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+// receive a segment from the overlay connection
+// in SNP_FRAMING_LENGTH mode the overlay is read in large chunks into the
+// connection's receive ring and segments are parsed out of the ring by length.
+// on a datagram overlay every datagram is one segment, received in batches by recvmmsg().
+// when a segment is received, use seglost to determine if the segment should be discarded
+//
+// Pseudocode
+// 1) While rx_next() gets a segment from the ring or the datagram batch
+//      apply seglost and checkchecksum, return it if valid
+// 2) Nothing is ready without waiting, return 0 (only with MSG_DONTWAIT)
+// 3) The overlay failed or closed, return -1
+//
+static int rx_segment(int connection, seg_t* segPtr, int flags) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL) {
+		return -1;
+	}
+	if (conn->duppending) {
+		conn->duppending = 0;
+		memcpy(segPtr, &conn->dupseg.seg, sizeof(srt_hdr_t) + conn->dupseg.seg.header.length);
+		return 1;
+	}
+	if (conn->overlay == SNP_OVERLAY_STREAM && conn->framing == SNP_FRAMING_DELIM) {
+		return snp_recvseg_delim(connection, conn, segPtr, flags);
+	}
+
+	int r;
+	while ((r = rx_next(connection, conn, segPtr, flags)) > 0) {
+		SNP_STAT_ADD(conn, rx_segs, 1);
+
+		//add segment error
+		int fate = seglost(conn, segPtr);
+		if (fate == IMPAIR_DROP) {
+			continue;
+		}
+
+		if (checkchecksum(segPtr) < 0) {
+			printf("checksum error,drop!\n");
+			SNP_STAT_ADD(conn, rx_badsum, 1);
+			continue;
+		}
+		if (fate == IMPAIR_DUP) {
+			rx_keepdup(conn, segPtr);
+		}
+		return 1;
+	}
+	return r;
+}
 
+int snp_recvseg(int connection, seg_t* segPtr) {
+	return rx_segment(connection, segPtr, 0);
+}
+
+int snp_tryrecvseg(int connection, seg_t* segPtr) {
+	return rx_segment(connection, segPtr, MSG_DONTWAIT);
+}
+
+int snp_getpollfd(int connection) {
+	snp_conn_t* conn = snp_getconn(connection);
+	if (conn == NULL) {
+		return -1;
+	}
+	if (conn->uring != NULL) {
+		unsigned long syscalls = 0;
+		int fd = uring_engine_pollfd(conn->uring, &syscalls);
+		SNP_STAT_ADD(conn, rx_syscalls, syscalls);
+		return fd;
+	}
+	return connection;
+}
+
+//apply the connection's impairment model (see impair.h) to a received segment.
+//the model replaces the old rand() based PKT_LOSS_RATE coin flips: it is seeded per
+//connection, so a loss pattern can be replayed, and it is safe to use from several threads
+//returns IMPAIR_PASS, IMPAIR_DROP (the segment is lost) or IMPAIR_DUP (deliver it twice)
+//
+// Pseudocode
+// 1) Ask the impairment model what happens to this segment
+// 2) Count and report lost, corrupted and duplicated segments
+//
+static int seglost(snp_conn_t* conn, seg_t* segPtr) {
+	int corrupted;
+	int fate = impair_apply(&conn->impair, segPtr, &corrupted);
+	if (fate == IMPAIR_DROP) {
+		printf("seg lost!!!\n");
+		SNP_STAT_ADD(conn, rx_lost, 1);
+	}
+	if (corrupted) {
+		SNP_STAT_ADD(conn, rx_corrupted, 1);
+	}
+	if (fate == IMPAIR_DUP) {
+		SNP_STAT_ADD(conn, rx_duplicated, 1);
+	}
+	return fate;
+}
+
+//Checksum kernels
+//
+//All kernels add the buffer as native-endian 64-bit words into a 64-bit accumulator
+//and carry the overflow back in (2^64 is 1 in ones' complement arithmetic modulo 0xFFFF,
+//just like 2^16). Folding to 16 bits is deferred to checksum_fold(), so the result is the
+//same 16-bit ones' complement sum the original word-at-a-time loop produced. A trailing
+//odd byte is summed as if followed by a 0 octet. When dst is not NULL the kernel also
+//copies the buffer to dst while it sums it.
+typedef unsigned long long (*csum_fn)(void* dst, const void* src, size_t len, unsigned long long sum);
+
+static unsigned long long csum_add64(unsigned long long sum, unsigned long long w) {
+	sum += w;
+	return sum + (sum < w);
+}
+
+//sum (and copy) the last len < 8 bytes, padding the word with 0 octets
+static unsigned long long csum_tail(unsigned char* d, const unsigned char* s, size_t len, unsigned long long sum) {
+	unsigned long long w = 0;
+	if (len == 0)
+		return sum;
+	memcpy(&w, s, len);
+	if (d != NULL)
+		memcpy(d, s, len);
+	return csum_add64(sum, w);
+}
+
+static unsigned long long csum_scalar(void* dst, const void* src, size_t len, unsigned long long sum) {
+	const unsigned char* s = src;
+	unsigned char* d = dst;
+	unsigned long long w;
+
+	if (d != NULL) {
+		for (; len >= 8; len -= 8, s += 8, d += 8) {
+			memcpy(&w, s, 8);
+			memcpy(d, &w, 8);
+			sum = csum_add64(sum, w);
+		}
+	}
+	else {
+		for (; len >= 8; len -= 8, s += 8) {
+			memcpy(&w, s, 8);
+			sum = csum_add64(sum, w);
+		}
+	}
+	return csum_tail(d, s, len, sum);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//each 32-bit lane is widened to 64 bits before it is added, so a lane cannot
+//overflow before 2^32 blocks have been summed
+__attribute__((target("sse2")))
+static unsigned long long csum_sse2(void* dst, const void* src, size_t len, unsigned long long sum) {
+	const unsigned char* s = src;
+	unsigned char* d = dst;
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+
+	for (; len >= 16; len -= 16, s += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)s);
+		if (d != NULL) {
+			_mm_storeu_si128((__m128i*)d, v);
+			d += 16;
+		}
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+	}
+
+	unsigned long long lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	sum = csum_add64(sum, lanes[0]);
+	sum = csum_add64(sum, lanes[1]);
+	return csum_scalar(d, s, len, sum);
+}
+
+__attribute__((target("avx2")))
+static unsigned long long csum_avx2(void* dst, const void* src, size_t len, unsigned long long sum) {
+	const unsigned char* s = src;
+	unsigned char* d = dst;
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+
+	for (; len >= 32; len -= 32, s += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)s);
+		if (d != NULL) {
+			_mm256_storeu_si256((__m256i*)d, v);
+			d += 32;
+		}
+		acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+		acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+	}
+
+	unsigned long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	for (int i = 0; i < 4; i++)
+		sum = csum_add64(sum, lanes[i]);
+	return csum_scalar(d, s, len, sum);
+}
+#endif
+
+//the original checksum loop: 16-bit words with the carry folded on every addition.
+//kept as the reference the fast kernels are checked against.
+static unsigned short csum_reference(const void* buf, int len) {
+	const unsigned char* p = buf;
+	long sum = 0;
+	while (len > 1) {
+		unsigned short word;
+		memcpy(&word, p, 2);
+		sum += word;
+		if (sum & 0x10000)
+			sum = (sum & 0xFFFF) + 1;
+		p += 2;
+		len -= 2;
+	}
+	if (len == 1) {
+		unsigned char last[2] = { p[0], 0 };
+		unsigned short word;
+		memcpy(&word, last, 2);
+		sum += word;
+		if (sum & 0x10000)
+			sum = (sum & 0xFFFF) + 1;
+	}
+	return sum;
+}
+
+static csum_fn csum_impl = csum_scalar;
+static const char* csum_name = "scalar";
+static pthread_once_t csum_once = PTHREAD_ONCE_INIT;
+
+//check a kernel bit for bit against csum_reference() over every length and
+//alignment of a segment, including the copy it makes
+static int csum_selftest(csum_fn fn) {
+	static unsigned char src[SEG_SIZE(MAX_SEG_LEN) + 8];
+	static unsigned char dst[SEG_SIZE(MAX_SEG_LEN) + 8];
+	unsigned int x = 2463534242u;
+	for (size_t i = 0; i < sizeof(src); i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		src[i] = x;
+	}
+	//every length up to a few vectors covers the tails, longer ones are sampled so that
+	//every process does not pay for thousands of reference sums at startup
+	for (int off = 0; off < 8; off++) {
+		for (int len = 0; len + off <= (int)SEG_SIZE(MAX_SEG_LEN); len += len < 160 ? 1 : 61) {
+			if (checksum_fold(fn(NULL, src + off, len, 0)) != csum_reference(src + off, len))
+				return -1;
+			if (checksum_fold(fn(dst + off, src + off, len, 0)) != csum_reference(src + off, len)
+					|| memcmp(dst + off, src + off, len) != 0)
+				return -1;
+		}
+	}
+	return 1;
+}
+
+//pick the fastest kernel the cpu supports, or the one named by SNP_CSUM,
+//and fall back to the scalar kernel if it does not match the reference.
+//avx2 before sse2 before scalar is only the order of speed when seg.c is optimised (-O2
+//in the Makefile); without it the intrinsics run slower than the scalar loop, see csumbench
+static void csum_init(void) {
+	char* want = getenv("SNP_CSUM");
+	csum_fn fn = csum_scalar;
+	const char* name = "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (want == NULL || strcmp(want, "scalar") != 0) {
+		if (__builtin_cpu_supports("avx2") && (want == NULL || strcmp(want, "avx2") == 0)) {
+			fn = csum_avx2;
+			name = "avx2";
+		}
+		else if (__builtin_cpu_supports("sse2") && (want == NULL || strcmp(want, "sse2") == 0)) {
+			fn = csum_sse2;
+			name = "sse2";
+		}
+	}
+#endif
+
+	if (fn != csum_scalar && csum_selftest(fn) < 0) {
+		printf("%s checksum kernel failed its self test, using scalar\n", name);
+		fn = csum_scalar;
+		name = "scalar";
+	}
+	csum_impl = fn;
+	csum_name = name;
+}
+
+unsigned long long checksum_partial(const void* buf, int len, unsigned long long sum) {
+	pthread_once(&csum_once, csum_init);
+	return csum_impl(NULL, buf, len, sum);
+}
+
+unsigned long long checksum_copy(void* dst, const void* src, int len, unsigned long long sum) {
+	pthread_once(&csum_once, csum_init);
+	return csum_impl(dst, src, len, sum);
+}
+
+unsigned short checksum_fold(unsigned long long sum) {
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+const char* checksum_kernel() {
+	pthread_once(&csum_once, csum_init);
+	return csum_name;
+}
+
+//switch to the kernel called name if the cpu supports it and it passes the self test
+int checksum_setkernel(const char* name) {
+	csum_fn fn = NULL;
+	const char* kernel = NULL;
+	pthread_once(&csum_once, csum_init);
+
+	if (strcmp(name, "scalar") == 0) {
+		fn = csum_scalar;
+		kernel = "scalar";
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+		fn = csum_sse2;
+		kernel = "sse2";
+	}
+	else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+		fn = csum_avx2;
+		kernel = "avx2";
+	}
+#endif
+	if (fn == NULL || (fn != csum_scalar && csum_selftest(fn) < 0))
+		return -1;
+	csum_impl = fn;
+	csum_name = kernel;
+	return 1;
 }
 
 //check checksum
@@ -173,40 +1072,18 @@ int seglost(seg_t* segPtr) {
 //return -1 if the result is not 0 
 //
 // Pseudocode
-// 1) sum = 0
-// 2) Get number of 16-bit blocks in segment (len)
-//      increment by 1 if need to
-// 3) temp = segment (temp is a pointer)
-// 4) while(len > 0)
-//      sum += *temp
-//      temp++
-//      if(sum & 0x10000)
-//        sum = (sum & 0xFFFF)+1 // Check for and take care of overflow
-//      len--
-// 5) result = ~sum
-// 6) if(resul == 0) return 1
+// 1) sum = ones' complement sum of D (checksum_partial, see the kernels above)
+// 2) result = ~checksum_fold(sum)
+// 3) if(result == 0) return 1
 //    else return -1
 //
 int checkchecksum(seg_t *segment){
-        long sum = 0;
-        //len is the number of 16-bit data to calculate the checksum
-        int len = sizeof(srt_hdr_t)+segment->header.length;
-        if(len%2==1)
-        	len++;
-        len = len/2;
-        unsigned short* temp = (unsigned short*)segment;
-
-        while(len > 0){
-        	sum += *temp;
-       		temp++;
-        	//if overflow, round the most significant 1
-        	if(sum & 0x10000)
-        		sum = (sum & 0xFFFF) + 1;
-        	len --;
-       }
-        
-       unsigned short result =~sum;
-       if(result == 0)
+	//a corrupted length field must not make us sum past the segment
+	if(segment->header.length > JUMBO_SEG_LEN)
+		return -1;
+	int len = sizeof(srt_hdr_t)+segment->header.length;
+	unsigned short result = ~checksum_fold(checksum_partial(segment, len, 0));
+	if(result == 0)
 		return 1;
 	else
 		return -1;
@@ -224,26 +1101,6 @@ int checkchecksum(seg_t *segment){
 //flip the all the bits of the sum to get the checksum
 unsigned short checksum(seg_t *segment){
 	segment->header.checksum = 0;
-	if(segment->header.length%2==1)
-		segment->data[segment->header.length] = 0;
-	
-	long sum = 0;  
-	//len is the number of 16-bit data to calculate the checksum
 	int len = sizeof(srt_hdr_t)+segment->header.length;
-	if(len%2==1)
-		len++;
-	len = len/2;
-	unsigned short* temp = (unsigned short*)segment;
-
-        while(len > 0){
-        	sum += *temp;
-		temp++;
-		//if overflow, round the most significant 1
-             	if(sum & 0x10000)   
-               		sum = (sum & 0xFFFF) + 1;
-             	len --;
-        }
-           	
-	return ~sum;
+	return ~checksum_fold(checksum_partial(segment, len, 0));
 }
-
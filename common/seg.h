@@ -27,21 +27,91 @@
 typedef struct srt_hdr {
 	unsigned int src_port;        //source port number
 	unsigned int dest_port;       //destination port number
-	unsigned int seq_num;         //sequence number
+	unsigned int seq_num;         //sequence number: DATA, of its first byte, bytes are numbered from 1 modulo 2^32; DATAACK, of the next byte expected
 	unsigned int ack_num;         //ack number
 	unsigned short int length;    //segment data length
 	unsigned short int  type;     //segment type
-	unsigned short int  rcv_win;  //currently not used
+	unsigned short int  rcv_win;  //SYNACK and DATAACK: free receive buffer beyond the ACKed bytes, in units of 1 << RCV_WIN_SHIFT bytes
 	unsigned short int checksum;  //checksum for this segment
 } srt_hdr_t;
 
-//segment definition
+//serial number arithmetic on the 32-bit sequence numbers (RFC 1982): a comes before b when it
+//is less than 2^31 bytes behind it, so comparisons stay right after the numbers wrap every
+//4 GB of a connection. Only sequence numbers within 2 GB of each other may be compared.
+#define SEQ_LT(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)) < 0)
+#define SEQ_LEQ(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)) <= 0)
+#define SEQ_GT(a, b) SEQ_LT(b, a)
+#define SEQ_GEQ(a, b) SEQ_LEQ(b, a)
+
+//selective ACK block. The data of a DATAACK holds header.length / sizeof(srt_sack_t) of them,
+//in sequence order: the receiver holds the data bytes [start, end) out of order, beyond the
+//cumulative ACK in header.seq_num.
+typedef struct srt_sack {
+	unsigned int start;
+	unsigned int end;
+} srt_sack_t;
+
+//segment definition. The data holds header.length bytes, up to the segment size the
+//connection negotiated in its SYN and SYNACK, so a seg_t is only ever used through a pointer
+//to storage sized with SEG_SIZE() or declared with SEGBUF().
 
 typedef struct segment {
 	srt_hdr_t header;
-	char data[MAX_SEG_LEN];
+	char data[];
 } seg_t;
 
+//bytes of storage for a segment of len data bytes, rounded up so that such segments can be
+//laid out back to back
+#define SEG_SIZE(len) ((sizeof(srt_hdr_t) + (len) + sizeof(int) - 1) / sizeof(int) * sizeof(int))
+
+//storage for a segment of up to len data bytes, used as its .seg member
+#define SEGBUF(len) union { seg_t seg; char bytes[SEG_SIZE(len)]; }
+
+//data of a SYN and a SYNACK. The SYN proposes the largest segment the client wants to send,
+//the SYNACK answers with the size both sides use, which is never larger. A SYN or SYNACK
+//shorter than this proposes or answers MAX_SEG_LEN.
+typedef struct srt_synopt {
+	unsigned int mss;             //data bytes of a full segment
+} srt_synopt_t;
+
+//snp_recvseg() framing modes.
+//SNP_FRAMING_DELIM scans the byte stream one recv() at a time for the !& and !# markers.
+//SNP_FRAMING_LENGTH reads the overlay in large chunks into a per-connection ring buffer and
+//uses the header length field to find where each segment ends.
+#define SNP_FRAMING_DELIM 0
+#define SNP_FRAMING_LENGTH 1
+
+//overlay kinds, see snp_getoverlay().
+//SNP_OVERLAY_STREAM carries framed segments over a byte stream such as a TCP connection.
+//SNP_OVERLAY_DGRAM carries exactly one segment per datagram, without !& and !# markers,
+//over a connected datagram socket such as UDP.
+//SNP_OVERLAY_SHM exchanges segments with a process on the same host through shared memory
+//rings, see snp_shm_start().
+#define SNP_OVERLAY_STREAM 0
+#define SNP_OVERLAY_DGRAM 1
+#define SNP_OVERLAY_SHM 2
+
+//I/O engines of a stream overlay, see snp_setengine().
+//SNP_ENGINE_SYSCALL reads and writes the overlay with blocking readv() and sendmsg() calls.
+//SNP_ENGINE_URING receives through a multishot io_uring recv and writes through a buffer
+//registered with io_uring, see snp_uring.h.
+#define SNP_ENGINE_SYSCALL 0
+#define SNP_ENGINE_URING 1
+
+//per-connection SNP counters, see snp_getstats()
+typedef struct snp_stats {
+	unsigned long rx_syscalls;      //recv()/recvmsg()/io_uring_enter() calls made on the overlay
+	unsigned long rx_segs;          //segments parsed, including those later dropped
+	unsigned long rx_bytes;         //bytes read from the overlay
+	unsigned long rx_lost;          //segments dropped by the impairment model
+	unsigned long rx_corrupted;     //segments the impairment model flipped a bit in
+	unsigned long rx_duplicated;    //segments the impairment model delivered twice
+	unsigned long rx_badsum;        //segments dropped because of a bad checksum
+	unsigned long tx_syscalls;      //sendmsg()/io_uring_enter() calls made on the overlay
+	unsigned long tx_segs;          //segments sent
+	unsigned long tx_bytes;         //bytes written to the overlay
+} snp_stats_t;
+
 //
 //
 //  SNP API for the client and server sides 
@@ -68,6 +138,29 @@ int snp_sendseg(int connection, seg_t* segPtr);
 // Return 1 in case of success, and -1 in case of failure. snp_sendseg() uses
 // send() to first send two chars, then send() again but for the seg_t, and, then
 // send() two chars for the end of packet. 
+// The framed segment is now handed to the kernel with a single sendmsg(); see snp_sendseg_batch().
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_sendseg_batch(int connection, seg_t** segs, int n);
+
+// Send n SRT segments over the overlay network. Unlike snp_sendseg(), the segments must already
+// carry a valid checksum, so a segment that is sent again is not summed again. The ``!&'' and ``!#'' markers and the segments are gathered into one sendmsg() for
+// every SNP_MAX_BATCH segments, so a burst of segments costs one syscall instead of three per
+// segment. Concurrent senders on the same connection are serialized so their frames never
+// interleave on the byte stream. Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_sendseg_gather(int connection, seg_t** segs, const char** data, int n);
+
+// Send n SRT segments like snp_sendseg_batch(), but when data is not NULL and data[i] is not
+// NULL, only the header of segs[i] is used and its header.length bytes of data are gathered
+// straight from data[i]. The checksum in the header must already cover that data. Segments
+// whose data lives in the caller's memory are thus sent without being copied into a seg_t.
+// Return 1 in case of success, and -1 in case of failure.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -75,50 +168,154 @@ int snp_sendseg(int connection, seg_t* segPtr);
 int snp_recvseg(int connection, seg_t* segPtr);
 
 // Receive a segment over overlay network (this is a single TCP connection in the case of
-// Lab4). We recommend that you receive one byte at a time using recv(). Here you are looking for 
+// Lab4). How the byte stream is split into segments depends on the connection's framing mode
+// (see snp_setframing()). With SNP_FRAMING_LENGTH the overlay is read in large chunks into a
+// ring buffer; each segment is located by its ``!&'' marker and header length, checked for the
+// trailing ``!#'' and copied once into segPtr. Bytes that do not frame a valid segment are
+// skipped until the next ``!&''. SNP_FRAMING_DELIM is the original parser described below.
+//
+// The original parser receives one byte at a time using recv(). Here you are looking for 
 // ``!&'' characters then seg_t and then ``!#''. This is a FSM of sorts and you
 // should code it that way. Make sure that you cover cases such as ``#&bbb!b!bn#bbb!#''
 // The assumption here (fairly limiting but simplistic) is that !& and !# will not 
 // be seen in the data in the segment. You should read in one byte as a char at 
 // a time and copy the data part into a buffer to be returned to the caller.
 //
-// IMPORTANT: once you have parsed a segment you should call seglost(). Here is the code
-// for seglost(seg_t* segment):
-// 
-// a segment has PKT_LOST_RATE probability to be lost or invalid checksum
-// with PKT_LOST_RATE/2 probability, the segment is lost, this function returns 1
-// if the segment is not lost, return 0 
-// Even the segment is not lost, the packet has PKT_LOST_RATE/2 probability to have invalid checksum
-//  We flip  a random bit in the segment to create invalid checksum
-int seglost(seg_t* segPtr); 
-// source code for seglost
-// copy this to seg.c
-/*
-int seglost(seg_t* segPtr) {
-	int random = rand()%100;
-	if(random<PKT_LOSS_RATE*100) {
-		//50% probability of losing a segment
-		if(rand()%2==0) {
-			printf("seg lost!!!\n");
-                        return 1;
-		}
-		//50% chance of invalid checksum
-		else {
-			//get data length
-			int len = sizeof(srt_hdr_t)+segPtr->header.length;
-			//get a random bit that will be flipped
-			int errorbit = rand()%(len*8);
-			//flip the bit
-			char* temp = (char*)segPtr;
-			temp = temp + errorbit/8;
-			*temp = *temp^(1<<(errorbit%8));
-			return 0;
-		}
-	}
-	return 0;
-
-}
-*/
+// IMPORTANT: once a segment has been parsed, seglost() applies the connection's impairment
+// model to it (see impair.h). The model loses, corrupts or duplicates segments with independent
+// probabilities and can add Gilbert-Elliott burst loss. Its random number generator is seeded
+// per connection, so the same loss pattern can be replayed. A lost segment is dropped, a
+// corrupted one has a random bit flipped and is dropped by the checksum check, and a
+// duplicated one is returned again by the next snp_recvseg() call. By default PKT_LOSS_RATE
+// is split evenly between loss and corruption; the SNP_IMPAIR environment variable or
+// snp_setimpair() change the model, and ``off'' disables it.
+//
+// segPtr must have room for any segment the overlay carries, SEG_SIZE(snp_getmaxseg(connection))
+// bytes; SEGBUF(JUMBO_SEG_LEN) holds a segment of every overlay.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_tryrecvseg(int connection, seg_t* segPtr);
+
+// Receive a segment like snp_recvseg(), but return 0 instead of waiting when no complete
+// segment can be had from the overlay right now. Bytes of a partly received segment stay
+// buffered for the next call. It is meant for an event loop that calls it whenever the
+// descriptor returned by snp_getpollfd() is readable, until it returns 0.
+// Return 1 if a segment was received, 0 if none is ready, and -1 if the overlay failed or closed.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_getpollfd(int connection);
+
+// Return the descriptor that becomes readable when snp_tryrecvseg() may have a segment for
+// the connection: the overlay socket itself, or the receive ring of the io_uring engine. On
+// a shared memory overlay the socket is readable once the peer rings its doorbell.
+// Return -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+void snp_release(int connection);
+
+// Free the SNP state of the overlay connection: its receive ring, io_uring engine and shared
+// memory mapping. It does not close the descriptor; call it before closing, once no thread
+// sends or receives on the connection any more. A descriptor number that is used again
+// afterwards starts with fresh state.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+struct impair_cfg;
+int snp_setimpair(int connection, const struct impair_cfg* cfg);
+
+// Replace the impairment model of the overlay connection and reseed its random number
+// generator from cfg->seed. Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_getoverlay(int connection);
+
+// Return the overlay kind of the connection, SNP_OVERLAY_STREAM, SNP_OVERLAY_DGRAM or SNP_OVERLAY_SHM, or -1
+// in case of failure. The kind follows the socket type: a SOCK_DGRAM socket (for example a
+// UDP socket connected to its peer) is a datagram overlay. On a datagram overlay
+// snp_sendseg_batch() sends every segment as its own datagram with one sendmmsg() per batch
+// and snp_recvseg() receives datagrams in batches with recvmmsg(). Datagrams whose size does
+// not match their header length are discarded. The framing mode does not apply.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_getmaxseg(int connection);
+
+// Return the most data bytes a segment sent on the overlay connection may carry, or -1 in
+// case of failure. Stream and datagram overlays carry segments of up to JUMBO_SEG_LEN, the
+// shared memory overlay only MAX_SEG_LEN, the size of its slots. The SRT ends never negotiate
+// a larger segment size than this, see srt_synopt_t.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_shm_start(int connection, int creator);
+
+// Switch a stream overlay connection between two processes on the same host to the shared
+// memory overlay (see snp_shm.h). Both ends call it right after the overlay connection is
+// established and before any segment is sent; exactly one of them passes creator = 1. The
+// creator makes the shared memory region and passes its name over the connection. From then
+// on snp_sendseg() and snp_recvseg() push and pop seg_t slots of the rings in the region and
+// the connection is only watched to notice that the peer has gone away.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_setengine(int connection, int engine);
+
+// Select the I/O engine of a stream overlay connection, SNP_ENGINE_SYSCALL or SNP_ENGINE_URING.
+// A connection starts with the engine named by the SNP_ENGINE environment variable (``uring''
+// or ``syscall''), or SNP_ENGINE_SYSCALL when it is unset. When io_uring is unavailable the
+// connection keeps using plain syscalls. The io_uring engine only carries the length framed
+// receive path; SNP_FRAMING_DELIM still reads one byte per recv(). The engine should be
+// chosen before the first segment is sent or received.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_getengine(int connection);
+
+// Return the I/O engine of the connection, SNP_ENGINE_SYSCALL or SNP_ENGINE_URING, or -1 in
+// case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_setframing(int connection, int mode);
+
+// Select the framing mode snp_recvseg() uses on the overlay connection, either
+// SNP_FRAMING_DELIM or SNP_FRAMING_LENGTH. A connection starts in the mode named by the
+// SNP_FRAMING environment variable (``delim'' or ``length''), or SNP_DEFAULT_FRAMING when
+// it is unset. The mode should be chosen before the first segment is received.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_recvready(int connection);
+
+// Return 1 if a complete segment is already buffered for the overlay connection, so the next
+// snp_recvseg() will not block on the overlay, and 0 otherwise. Callers use it to decide when
+// to flush replies they have been batching.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int snp_getstats(int connection, snp_stats_t* stats);
+
+// Copy the SNP counters of the overlay connection into stats.
+// Return 1 in case of success, and -1 in case of failure.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
@@ -133,4 +330,25 @@ unsigned short checksum(seg_t* segment);
 //return 1 if the checksum is valid,
 //return -1 if the checksum is invalid
 int checkchecksum(seg_t* segment);
+
+//add len bytes at buf to the running ones' complement sum and return the new sum.
+//the sum is kept in 64 bits and only folded by checksum_fold(), so a checksum can be
+//built from pieces; every piece except the last must have an even length
+unsigned long long checksum_partial(const void* buf, int len, unsigned long long sum);
+
+//copy len bytes from src to dst and add them to the running sum in the same pass
+unsigned long long checksum_copy(void* dst, const void* src, int len, unsigned long long sum);
+
+//fold a running sum to the 16-bit ones' complement sum. The checksum is its complement.
+unsigned short checksum_fold(unsigned long long sum);
+
+//name of the checksum kernel in use: "scalar", "sse2" or "avx2". The fastest kernel the cpu
+//supports is chosen at run time unless the SNP_CSUM environment variable names one, and
+//it is checked bit for bit against the original word-at-a-time loop before it is used.
+const char* checksum_kernel();
+
+//use the checksum kernel called name ("scalar", "sse2" or "avx2") from now on, see csumbench.
+//only call it while no connection is running. return 1 if the kernel is in use, and -1 if
+//the cpu does not support it or it fails the self test
+int checksum_setkernel(const char* name);
 #endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+//FILE: common/slab.c
+//
+//Description: fixed size object pools with per-thread caches, used for the TCBs and
+//connection buffers of the SRT client and server
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "constants.h"
+#include "slab.h"
+
+//a free object holds the link to the next free object in its first bytes
+typedef struct slab_obj {
+	struct slab_obj* next;
+} slab_obj_t;
+
+//the free objects one thread keeps for one pool
+typedef struct slab_cache {
+	slab_pool_t* pool;
+	slab_obj_t* head;
+	int count;
+	unsigned long hits;         //hits not yet added to the pool, so a hit takes no lock
+} slab_cache_t;
+
+struct slab_pool {
+	const char* name;
+	size_t size;                //object size rounded up to the alignment
+	int perslab;
+	int batch;                  //objects moved between a thread cache and the shared free list at once
+	pthread_key_t cachekey;     //the calling thread's slab_cache_t
+	pthread_mutex_t mutex;      //guards the fields below
+	slab_obj_t* freelist;
+	unsigned long slabs;
+	unsigned long misses;
+	unsigned long hits;         //hits of threads that have since moved objects to or from the free list
+	struct slab_pool* next;
+};
+
+//every pool created, for slab_print()
+static slab_pool_t* pools = NULL;
+static pthread_mutex_t poolsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Move up to n objects from the front of the list at *from to the cache.
+// The caller must hold the pool mutex.
+static void cache_take(slab_cache_t* cache, slab_obj_t** from, int n)
+{
+	while (n > 0 && *from != NULL){
+		slab_obj_t* obj = *from;
+		*from = obj->next;
+		obj->next = cache->head;
+		cache->head = obj;
+		cache->count++;
+		n--;
+	}
+}
+
+// Move up to n objects from the cache back to the pool's free list.
+// The caller must hold the pool mutex.
+static void cache_give(slab_cache_t* cache, int n)
+{
+	while (n > 0 && cache->head != NULL){
+		slab_obj_t* obj = cache->head;
+		cache->head = obj->next;
+		obj->next = cache->pool->freelist;
+		cache->pool->freelist = obj;
+		cache->count--;
+		n--;
+	}
+}
+
+// Add the calling thread's pending hits to the pool. The caller must hold the pool mutex.
+static void cache_account(slab_cache_t* cache)
+{
+	cache->pool->hits += cache->hits;
+	cache->hits = 0;
+}
+
+// pthread key destructor: give everything the exiting thread cached back to the pool
+static void cache_destroy(void* arg)
+{
+	slab_cache_t* cache = arg;
+	pthread_mutex_lock(&cache->pool->mutex);
+	cache_give(cache, cache->count);
+	cache_account(cache);
+	pthread_mutex_unlock(&cache->pool->mutex);
+	free(cache);
+}
+
+// Return the calling thread's cache for the pool, creating it on first use
+static slab_cache_t* cache_get(slab_pool_t* pool)
+{
+	slab_cache_t* cache = pthread_getspecific(pool->cachekey);
+	if (cache == NULL){
+		cache = calloc(1, sizeof(slab_cache_t));
+		if (cache == NULL){
+			return NULL;
+		}
+		cache->pool = pool;
+		pthread_setspecific(pool->cachekey, cache);
+	}
+	return cache;
+}
+
+slab_pool_t* slab_create(const char* name, size_t size, int perslab)
+{
+	slab_pool_t* pool = calloc(1, sizeof(slab_pool_t));
+	if (pool == NULL){
+		return NULL;
+	}
+	if (pthread_key_create(&pool->cachekey, cache_destroy) != 0){
+		free(pool);
+		return NULL;
+	}
+	if (size < sizeof(slab_obj_t)){
+		size = sizeof(slab_obj_t);
+	}
+	pool->name = name;
+	pool->size = (size + 15) & ~(size_t)15;
+	pool->perslab = perslab > 0 ? perslab : 1;
+	pool->batch = SLAB_CACHE_BYTES / pool->size;
+	if (pool->batch < 1){
+		pool->batch = 1;
+	}
+	if (pool->batch > SLAB_CACHE_OBJS){
+		pool->batch = SLAB_CACHE_OBJS;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+
+	pthread_mutex_lock(&poolsMutex);
+	pool->next = pools;
+	pools = pool;
+	pthread_mutex_unlock(&poolsMutex);
+	return pool;
+}
+
+void* slab_alloc(slab_pool_t* pool)
+{
+	slab_cache_t* cache = cache_get(pool);
+	if (cache == NULL){
+		return NULL;
+	}
+
+	int miss = cache->head == NULL;
+	if (miss){
+		// Refill the cache from the free list, carving a new slab if it is empty
+		pthread_mutex_lock(&pool->mutex);
+		pool->misses++;
+		if (pool->freelist == NULL){
+			char* slab = malloc(pool->size * pool->perslab);
+			if (slab == NULL){
+				pthread_mutex_unlock(&pool->mutex);
+				return NULL;
+			}
+			for (int i = pool->perslab - 1; i >= 0; i--){
+				slab_obj_t* obj = (slab_obj_t*)(slab + i * pool->size);
+				obj->next = pool->freelist;
+				pool->freelist = obj;
+			}
+			pool->slabs++;
+		}
+		cache_take(cache, &pool->freelist, pool->batch);
+		cache_account(cache);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	slab_obj_t* obj = cache->head;
+	cache->head = obj->next;
+	cache->count--;
+	cache->hits += !miss;
+	return obj;
+}
+
+void slab_free(slab_pool_t* pool, void* obj)
+{
+	slab_cache_t* cache = cache_get(pool);
+	if (cache == NULL){
+		// Without a cache the object goes straight back to the free list
+		pthread_mutex_lock(&pool->mutex);
+		((slab_obj_t*)obj)->next = pool->freelist;
+		pool->freelist = obj;
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	((slab_obj_t*)obj)->next = cache->head;
+	cache->head = obj;
+	cache->count++;
+
+	// Keep at most two batches, so a thread that only frees does not hoard the pool
+	if (cache->count > 2 * pool->batch){
+		pthread_mutex_lock(&pool->mutex);
+		cache_give(cache, pool->batch);
+		cache_account(cache);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+void slab_getstats(slab_pool_t* pool, slab_stats_t* stats)
+{
+	slab_cache_t* cache = cache_get(pool);
+	pthread_mutex_lock(&pool->mutex);
+	if (cache != NULL){
+		cache_account(cache);
+	}
+	stats->hits = pool->hits;
+	stats->misses = pool->misses;
+	stats->slabs = pool->slabs;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void slab_print()
+{
+	slab_stats_t stats;
+	pthread_mutex_lock(&poolsMutex);
+	for (slab_pool_t* pool = pools; pool != NULL; pool = pool->next){
+		slab_getstats(pool, &stats);
+		printf("slab %s: %lu hits, %lu misses, %lu slabs of %d x %zu bytes\n",
+			pool->name, stats.hits, stats.misses, stats.slabs, pool->perslab, pool->size);
+	}
+	pthread_mutex_unlock(&poolsMutex);
+}
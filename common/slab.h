@@ -0,0 +1,54 @@
+//
+// FILE: slab.h
+//
+// Description: This file contains the slab allocator the SRT client and server take their
+// TCBs and connection buffers from. A slab pool hands out objects of one fixed size. It
+// carves them out of large malloc()ed slabs and never gives a slab back, so once a pool has
+// grown to the number of objects an application keeps alive, creating and closing sockets
+// costs no malloc() or free() call.
+//
+// Every thread keeps a small cache of free objects for each pool, so most allocations and
+// frees take no lock. A thread whose cache is empty moves a batch of objects from the pool's
+// shared free list, and a thread whose cache has grown too large moves a batch back. The
+// objects a thread still caches when it exits are returned to the shared free list.
+//
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+typedef struct slab_pool slab_pool_t;
+
+//slab pool counters, see slab_getstats()
+typedef struct slab_stats {
+	unsigned long hits;         //allocations served from the calling thread's cache
+	unsigned long misses;       //allocations that had to refill the cache from the shared free list
+	unsigned long slabs;        //slabs malloc()ed by the pool
+} slab_stats_t;
+
+// Create a pool of objects of size bytes, carved perslab at a time out of each slab.
+// Objects are aligned to 16 bytes. The name is only used by slab_print().
+// Returns NULL in case of failure.
+//
+slab_pool_t* slab_create(const char* name, size_t size, int perslab);
+
+// Take an object from the pool. Its contents are undefined.
+// Returns NULL if the pool needed a new slab and malloc() failed.
+//
+void* slab_alloc(slab_pool_t* pool);
+
+// Return an object taken from the pool with slab_alloc().
+//
+void slab_free(slab_pool_t* pool, void* obj);
+
+// Copy the counters of the pool into stats. Hits of other threads are only counted once
+// they have moved objects to or from the shared free list.
+//
+void slab_getstats(slab_pool_t* pool, slab_stats_t* stats);
+
+// Print the counters of every pool created in this process.
+//
+void slab_print();
+
+#endif
@@ -0,0 +1,270 @@
+//FILE: common/snp_shm.c
+//
+//Description: shared memory overlay for co-located SRT client and server processes:
+//two single-producer/single-consumer rings of segment slots with futex wake-ups
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "snp_shm.h"
+
+#define CACHELINE 64
+//length of the region name sent over the overlay connection
+#define SHM_NAME_LEN 64
+
+//how a consumer waiting on an empty ring wants to be woken: by a futex wake on tail, or
+//by a doorbell byte on the overlay connection, which an event loop can poll
+#define SHM_SLEEP_FUTEX 1
+#define SHM_SLEEP_DOORBELL 2
+
+//one direction of the overlay. head is only written by the consumer and tail only by the
+//producer, so each sits on its own cache line; both are also used as futex words.
+typedef struct shm_ring {
+	unsigned int head;                  //next slot the consumer reads, free running
+	char pad0[CACHELINE - sizeof(unsigned int)];
+	unsigned int tail;                  //next slot the producer writes, free running
+	char pad1[CACHELINE - sizeof(unsigned int)];
+	unsigned int sleeping;              //the consumer waits for a segment, see SHM_SLEEP_FUTEX/DOORBELL
+	unsigned int spacewait;             //the producer waits on head for a free slot
+	char pad2[CACHELINE - 2 * sizeof(unsigned int)];
+	SEGBUF(MAX_SEG_LEN) slots[SNP_SHM_SLOTS];  //segments of up to MAX_SEG_LEN, see snp_getmaxseg()
+} shm_ring_t;
+
+//ring[0] is written by the side that created the region, ring[1] by the side that attached
+typedef struct shm_region {
+	shm_ring_t ring[2];
+} shm_region_t;
+
+struct shm_overlay {
+	shm_region_t* region;
+	shm_ring_t* tx;
+	shm_ring_t* rx;
+};
+
+static long futex(unsigned int* addr, int op, unsigned int val, const struct timespec* timeout) {
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+//the futex waits time out now and then so a vanished peer is noticed
+static const struct timespec shm_wait = { 0, SNP_SHM_WAIT_TIMEOUT };
+
+//the peer has closed the overlay connection
+static int peer_closed(int connection) {
+	struct pollfd pfd;
+	char c;
+	pfd.fd = connection;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) <= 0)
+		return 0;
+	if (pfd.revents & (POLLHUP | POLLERR))
+		return 1;
+	return recv(connection, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+//map the region through the descriptor and set up the ring pointers
+static shm_overlay_t* shm_map(int fd, int creator) {
+	shm_overlay_t* shm = malloc(sizeof(shm_overlay_t));
+	if (shm == NULL)
+		return NULL;
+	shm->region = mmap(NULL, sizeof(shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm->region == MAP_FAILED) {
+		free(shm);
+		return NULL;
+	}
+	shm->tx = &shm->region->ring[creator ? 0 : 1];
+	shm->rx = &shm->region->ring[creator ? 1 : 0];
+	return shm;
+}
+
+shm_overlay_t* shm_overlay_create(int connection) {
+	char name[SHM_NAME_LEN];
+	char ack;
+
+	memset(name, 0, sizeof(name));
+	snprintf(name, sizeof(name), "/srt_overlay_%d_%d", getpid(), connection);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, sizeof(shm_region_t)) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	shm_overlay_t* shm = shm_map(fd, 1);
+	close(fd);
+
+	//the new region is zero filled, which is two empty rings
+	if (shm == NULL
+			|| send(connection, name, sizeof(name), 0) != sizeof(name)
+			|| recv(connection, &ack, 1, MSG_WAITALL) != 1) {
+		shm_unlink(name);
+		if (shm != NULL) {
+			munmap(shm->region, sizeof(shm_region_t));
+			free(shm);
+		}
+		return NULL;
+	}
+	shm_unlink(name);
+	return shm;
+}
+
+shm_overlay_t* shm_overlay_attach(int connection) {
+	char name[SHM_NAME_LEN];
+	char ack = 1;
+
+	if (recv(connection, name, sizeof(name), MSG_WAITALL) != sizeof(name))
+		return NULL;
+	name[SHM_NAME_LEN - 1] = '\0';
+	int fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0)
+		return NULL;
+	shm_overlay_t* shm = shm_map(fd, 0);
+	close(fd);
+	if (shm == NULL)
+		return NULL;
+	if (send(connection, &ack, 1, 0) != 1) {
+		munmap(shm->region, sizeof(shm_region_t));
+		free(shm);
+		return NULL;
+	}
+	return shm;
+}
+
+//wake the consumer of the ring if it sleeps on an empty ring
+static void wake_consumer(shm_ring_t* ring, int connection, unsigned long* syscalls) {
+	char bell = 0;
+	unsigned int sleeping = __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+	if (sleeping == SHM_SLEEP_FUTEX) {
+		futex(&ring->tail, FUTEX_WAKE, 1, NULL);
+		(*syscalls)++;
+	}
+	else if (sleeping == SHM_SLEEP_DOORBELL) {
+		send(connection, &bell, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+		(*syscalls)++;
+	}
+}
+
+// Pseudocode
+// 1) For every segment, wait while the ring is full
+// 2) Copy the segment into the slot at tail and publish the new tail
+// 3) Wake the consumer if it went to sleep on the empty ring
+//
+int shm_overlay_push(shm_overlay_t* shm, int connection, seg_t** segs, const char** data, int n, unsigned long* syscalls) {
+	shm_ring_t* ring = shm->tx;
+	unsigned int tail = ring->tail;
+
+	for (int i = 0; i < n; i++) {
+		while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == SNP_SHM_SLOTS) {
+			wake_consumer(ring, connection, syscalls);
+			__atomic_store_n(&ring->spacewait, 1, __ATOMIC_SEQ_CST);
+			unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+			if (tail - head == SNP_SHM_SLOTS) {
+				futex(&ring->head, FUTEX_WAIT, head, &shm_wait);
+				(*syscalls)++;
+				if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == SNP_SHM_SLOTS && peer_closed(connection))
+					return -1;
+			}
+			__atomic_store_n(&ring->spacewait, 0, __ATOMIC_SEQ_CST);
+		}
+		//a segment too long for a slot is cut short, and fails its checksum at the peer
+		seg_t* slot = &ring->slots[tail & (SNP_SHM_SLOTS - 1)].seg;
+		unsigned int len = segs[i]->header.length;
+		if (len > MAX_SEG_LEN)
+			len = MAX_SEG_LEN;
+		if (data != NULL && data[i] != NULL) {
+			memcpy(&slot->header, &segs[i]->header, sizeof(srt_hdr_t));
+			memcpy(slot->data, data[i], len);
+		}
+		else
+			memcpy(slot, segs[i], sizeof(srt_hdr_t) + len);
+		slot->header.length = len;
+		tail++;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+	}
+	wake_consumer(ring, connection, syscalls);
+	return 1;
+}
+
+// Ask for a doorbell on the overlay connection when the empty ring gets a segment.
+// Returns 1 if the ring is still empty, 0 if a segment arrived meanwhile and -1 if the peer
+// has gone away.
+static int ring_doorbell(shm_ring_t* ring, int connection, unsigned int head, unsigned long* syscalls) {
+	char bells[64];
+	ssize_t n;
+
+	//take the old doorbells off the connection, so it is only readable again for a new one
+	while ((n = recv(connection, bells, sizeof(bells), MSG_DONTWAIT)) > 0)
+		(*syscalls)++;
+	(*syscalls)++;
+	if (n == 0)
+		return -1;
+	__atomic_store_n(&ring->sleeping, SHM_SLEEP_DOORBELL, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != head) {
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+	return 1;
+}
+
+// Pseudocode
+// 1) While the ring is empty, announce that we sleep and wait on tail; with nonblock set
+//    ask for a doorbell instead and return 0
+// 2) Copy the segment at head into segPtr and publish the new head
+// 3) Wake the producer if it waits for a free slot
+//
+int shm_overlay_pop(shm_overlay_t* shm, int connection, seg_t* segPtr, int nonblock, unsigned long* syscalls) {
+	shm_ring_t* ring = shm->rx;
+	unsigned int head = ring->head;
+
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+		if (nonblock) {
+			int r = ring_doorbell(ring, connection, head, syscalls);
+			if (r != 0)
+				return r > 0 ? 0 : -1;
+			continue;
+		}
+		__atomic_store_n(&ring->sleeping, SHM_SLEEP_FUTEX, __ATOMIC_SEQ_CST);
+		unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+		if (tail == head) {
+			futex(&ring->tail, FUTEX_WAIT, tail, &shm_wait);
+			(*syscalls)++;
+			if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head && peer_closed(connection))
+				return -1;
+		}
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	seg_t* slot = &ring->slots[head & (SNP_SHM_SLOTS - 1)].seg;
+	unsigned int len = slot->header.length;
+	if (len > MAX_SEG_LEN)
+		len = MAX_SEG_LEN;
+	memcpy(segPtr, slot, sizeof(srt_hdr_t) + len);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&ring->spacewait, 0, __ATOMIC_SEQ_CST)) {
+		futex(&ring->head, FUTEX_WAKE, 1, NULL);
+		(*syscalls)++;
+	}
+	return 1;
+}
+
+int shm_overlay_ready(shm_overlay_t* shm) {
+	return __atomic_load_n(&shm->rx->tail, __ATOMIC_ACQUIRE) != shm->rx->head;
+}
+
+void shm_overlay_destroy(shm_overlay_t* shm) {
+	if (shm == NULL)
+		return;
+	munmap(shm->region, sizeof(shm_region_t));
+	free(shm);
+}
@@ -0,0 +1,58 @@
+//
+// FILE: snp_shm.h
+//
+// Description: This file contains the shared memory overlay used by the SNP layer when the
+// client and server run on the same host. The two processes map one shared memory region
+// holding two single-producer/single-consumer rings of segment slots, one per direction.
+// Sending a segment copies it into the next free slot of the outgoing ring and receiving one
+// copies it out of the incoming ring. A consumer that finds its ring empty sleeps on a futex
+// in the region, and the producer only makes the wake-up syscall when the consumer is asleep.
+//
+// The overlay TCP connection is used to set the region up and afterwards only to notice that
+// the peer has gone away, and to ring a doorbell for a consumer that polls it.
+//
+
+#ifndef SNP_SHM_H
+#define SNP_SHM_H
+
+#include "seg.h"
+
+typedef struct shm_overlay shm_overlay_t;
+
+// Create the shared memory region, send its name to the peer over the overlay connection
+// and unlink it once the peer has mapped it. Returns NULL in case of failure.
+//
+shm_overlay_t* shm_overlay_create(int connection);
+
+// Receive the region name from the peer over the overlay connection and map the region.
+// Returns NULL in case of failure.
+//
+shm_overlay_t* shm_overlay_attach(int connection);
+
+// Copy n segments into the outgoing ring, waiting for free slots when it is full, and wake
+// the peer if it sleeps on an empty ring. When data is not NULL and data[i] is not NULL, the
+// data of segment i is copied from data[i] rather than from segs[i]->data.
+// *syscalls is increased by the futex calls made.
+// Return 1 in case of success, and -1 if the peer has gone away.
+//
+int shm_overlay_push(shm_overlay_t* shm, int connection, seg_t** segs, const char** data, int n, unsigned long* syscalls);
+
+// Copy the next segment of the incoming ring into segPtr, sleeping while the ring is empty.
+// With nonblock set it returns 0 instead of sleeping, after asking the peer to send a
+// doorbell byte over the overlay connection when the next segment is pushed, so the
+// connection can be polled for incoming segments. *syscalls is increased by the futex,
+// send and recv calls made.
+// Return 1 in case of success, 0 if nonblock is set and the ring is empty, and -1 if the
+// peer has gone away.
+//
+int shm_overlay_pop(shm_overlay_t* shm, int connection, seg_t* segPtr, int nonblock, unsigned long* syscalls);
+
+// Return 1 if the incoming ring holds a segment and 0 otherwise.
+//
+int shm_overlay_ready(shm_overlay_t* shm);
+
+// Unmap the region and free the overlay. The peer keeps its own mapping.
+//
+void shm_overlay_destroy(shm_overlay_t* shm);
+
+#endif
@@ -0,0 +1,416 @@
+//FILE: common/snp_uring.c
+//
+//Description: io_uring I/O engine for a stream overlay connection: a multishot recv into
+//provided buffers and batched writes from a registered buffer, driven by raw syscalls
+//
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "seg.h"
+#include "snp_uring.h"
+
+//the receive ring only ever has the multishot recv outstanding, the send ring one write
+#define URING_SQ_ENTRIES 4
+#define URING_RX_CQ_ENTRIES (2 * SNP_URING_BUFS)
+//buffer group of the provided receive buffers
+#define URING_BGID 0
+//the send buffer holds a full batch of framed MAX_SEG_LEN segments, a batch of larger ones
+//is written in several rounds
+#define URING_TXBUF_SIZE (SNP_MAX_BATCH * (SEG_SIZE(MAX_SEG_LEN) + 4))
+
+//one submission/completion queue pair mapped from the kernel
+typedef struct uring {
+	int fd;
+	void* sqmap;
+	size_t sqmaplen;
+	void* cqmap;
+	size_t cqmaplen;
+	struct io_uring_sqe* sqes;
+	size_t sqeslen;
+	unsigned int* sqhead;
+	unsigned int* sqtail;
+	unsigned int sqmask;
+	unsigned int* sqarray;
+	unsigned int* cqhead;
+	unsigned int* cqtail;
+	unsigned int cqmask;
+	struct io_uring_cqe* cqes;
+	unsigned int tosubmit;      //sqes queued since the last io_uring_enter()
+} uring_t;
+
+struct uring_engine {
+	int connection;
+	uring_t rx;
+	uring_t tx;
+	struct io_uring_buf_ring* bufring; //provided buffer ring shared with the kernel
+	char* rxbufs;               //SNP_URING_BUFS buffers of SNP_URING_BUFSIZE bytes
+	unsigned short buftail;     //provided buffer ring tail, free running
+	int armed;                  //a recv is outstanding or queued
+	int multishot;              //0 once the kernel refused a multishot recv
+	int curbid;                 //buffer being copied out, -1 if none
+	unsigned int curoff;        //next byte of the current buffer to copy
+	unsigned int curlen;        //bytes of the current buffer still to copy
+	int eof;                    //the peer closed the connection
+	int error;                  //errno of a failed recv, 0 if none
+	char* txbuf;                //registered send buffer of URING_TXBUF_SIZE bytes
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int tosubmit, unsigned int mincomplete, unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nargs) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static void uring_free(uring_t* ring) {
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqeslen);
+	if (ring->cqmap != NULL && ring->cqmap != MAP_FAILED && ring->cqmap != ring->sqmap)
+		munmap(ring->cqmap, ring->cqmaplen);
+	if (ring->sqmap != NULL && ring->sqmap != MAP_FAILED)
+		munmap(ring->sqmap, ring->sqmaplen);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->fd = -1;
+}
+
+// Create a ring and map its queues. Returns 1 in case of success, and -1 in case of failure.
+static int uring_init(uring_t* ring, unsigned int cqentries) {
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+	if (cqentries > 0) {
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = cqentries;
+	}
+	ring->fd = sys_io_uring_setup(URING_SQ_ENTRIES, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqmaplen > ring->sqmaplen)
+			ring->sqmaplen = ring->cqmaplen;
+		ring->cqmaplen = ring->sqmaplen;
+	}
+	ring->sqmap = mmap(NULL, ring->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqmap == MAP_FAILED) {
+		uring_free(ring);
+		return -1;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cqmap = ring->sqmap;
+	else
+		ring->cqmap = mmap(NULL, ring->cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cqmap == MAP_FAILED) {
+		uring_free(ring);
+		return -1;
+	}
+	ring->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		uring_free(ring);
+		return -1;
+	}
+
+	char* sq = ring->sqmap;
+	char* cq = ring->cqmap;
+	ring->sqhead = (unsigned int*)(sq + p.sq_off.head);
+	ring->sqtail = (unsigned int*)(sq + p.sq_off.tail);
+	ring->sqmask = *(unsigned int*)(sq + p.sq_off.ring_mask);
+	ring->sqarray = (unsigned int*)(sq + p.sq_off.array);
+	ring->cqhead = (unsigned int*)(cq + p.cq_off.head);
+	ring->cqtail = (unsigned int*)(cq + p.cq_off.tail);
+	ring->cqmask = *(unsigned int*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return 1;
+}
+
+//queue a cleared sqe; it reaches the kernel with the next io_uring_enter()
+static struct io_uring_sqe* uring_sqe(uring_t* ring) {
+	unsigned int tail = *ring->sqtail;
+	unsigned int idx = tail & ring->sqmask;
+	struct io_uring_sqe* sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sqarray[idx] = idx;
+	__atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+	ring->tosubmit++;
+	return sqe;
+}
+
+//take the next completion off the queue, returns 0 if it is empty
+static int uring_cqe(uring_t* ring, struct io_uring_cqe* cqe) {
+	unsigned int head = *ring->cqhead;
+	if (head == __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE))
+		return 0;
+	*cqe = ring->cqes[head & ring->cqmask];
+	__atomic_store_n(ring->cqhead, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+//submit the queued sqes and wait for at least one completion
+static int uring_wait(uring_t* ring, unsigned long* syscalls) {
+	int r = sys_io_uring_enter(ring->fd, ring->tosubmit, 1, IORING_ENTER_GETEVENTS);
+	(*syscalls)++;
+	if (r < 0)
+		return -1;
+	ring->tosubmit -= r;
+	return 1;
+}
+
+//hand a receive buffer back to the kernel
+static void rx_recycle(uring_engine_t* eng, int bid) {
+	struct io_uring_buf* buf = &eng->bufring->bufs[eng->buftail & (SNP_URING_BUFS - 1)];
+	buf->addr = (unsigned long)(eng->rxbufs + (size_t)bid * SNP_URING_BUFSIZE);
+	buf->len = SNP_URING_BUFSIZE;
+	buf->bid = bid;
+	eng->buftail++;
+	__atomic_store_n(&eng->bufring->tail, eng->buftail, __ATOMIC_RELEASE);
+}
+
+//queue a recv that picks its buffer from the provided buffer group
+static void rx_arm(uring_engine_t* eng) {
+	struct io_uring_sqe* sqe = uring_sqe(&eng->rx);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = eng->connection;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	if (eng->multishot)
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	eng->armed = 1;
+}
+
+uring_engine_t* uring_engine_create(int connection) {
+	uring_engine_t* eng = calloc(1, sizeof(uring_engine_t));
+	if (eng == NULL)
+		return NULL;
+	eng->connection = connection;
+	eng->multishot = 1;
+	eng->curbid = -1;
+	eng->rx.fd = -1;
+	eng->tx.fd = -1;
+	eng->bufring = MAP_FAILED;
+
+	if (uring_init(&eng->rx, URING_RX_CQ_ENTRIES) < 0 || uring_init(&eng->tx, 0) < 0) {
+		uring_engine_destroy(eng);
+		return NULL;
+	}
+
+	//the provided buffer ring must be page aligned, so it is mapped rather than malloc()ed
+	eng->bufring = mmap(NULL, SNP_URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	eng->rxbufs = malloc((size_t)SNP_URING_BUFS * SNP_URING_BUFSIZE);
+	eng->txbuf = malloc(URING_TXBUF_SIZE);
+	if (eng->bufring == MAP_FAILED || eng->rxbufs == NULL || eng->txbuf == NULL) {
+		uring_engine_destroy(eng);
+		return NULL;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)eng->bufring;
+	reg.ring_entries = SNP_URING_BUFS;
+	reg.bgid = URING_BGID;
+	if (sys_io_uring_register(eng->rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		uring_engine_destroy(eng);
+		return NULL;
+	}
+	for (int i = 0; i < SNP_URING_BUFS; i++)
+		rx_recycle(eng, i);
+
+	struct iovec txiov;
+	txiov.iov_base = eng->txbuf;
+	txiov.iov_len = URING_TXBUF_SIZE;
+	if (sys_io_uring_register(eng->tx.fd, IORING_REGISTER_BUFFERS, &txiov, 1) < 0) {
+		uring_engine_destroy(eng);
+		return NULL;
+	}
+	return eng;
+}
+
+void uring_engine_destroy(uring_engine_t* eng) {
+	if (eng == NULL)
+		return;
+	//closing the ring cancels the outstanding recv before its buffers go away
+	uring_free(&eng->rx);
+	uring_free(&eng->tx);
+	if (eng->bufring != MAP_FAILED)
+		munmap(eng->bufring, SNP_URING_BUFS * sizeof(struct io_uring_buf));
+	free(eng->rxbufs);
+	free(eng->txbuf);
+	free(eng);
+}
+
+//submit the queued sqes without waiting for completions
+static int uring_submit(uring_t* ring, unsigned long* syscalls) {
+	if (ring->tosubmit == 0)
+		return 1;
+	int r = sys_io_uring_enter(ring->fd, ring->tosubmit, 0, 0);
+	(*syscalls)++;
+	if (r < 0)
+		return -1;
+	ring->tosubmit -= r;
+	return 1;
+}
+
+int uring_engine_pollfd(uring_engine_t* eng, unsigned long* syscalls) {
+	if (!eng->armed && !eng->eof && !eng->error)
+		rx_arm(eng);
+	uring_submit(&eng->rx, syscalls);
+	return eng->rx.fd;
+}
+
+// Pseudocode
+// 1) Copy what is left of the current receive buffer into the iovecs, recycling it when empty
+// 2) Take the next completion: data becomes the current buffer, end of stream or an error
+//    stop the copy, and a completion without IORING_CQE_F_MORE means the recv must be armed again
+// 3) Only wait in io_uring_enter() while nothing has been copied yet, and with nonblock set
+//    submit a re-armed recv and fail with EAGAIN instead
+//
+int uring_engine_readv(uring_engine_t* eng, const struct iovec* iov, int iovcnt, int nonblock, unsigned long* syscalls) {
+	int copied = 0;
+	int idx = 0;
+	size_t iovoff = 0;
+	struct io_uring_cqe cqe;
+
+	while (idx < iovcnt) {
+		if (iovoff == iov[idx].iov_len) {
+			idx++;
+			iovoff = 0;
+			continue;
+		}
+		if (eng->curlen > 0) {
+			size_t n = iov[idx].iov_len - iovoff;
+			if (n > eng->curlen)
+				n = eng->curlen;
+			memcpy((char*)iov[idx].iov_base + iovoff, eng->rxbufs + (size_t)eng->curbid * SNP_URING_BUFSIZE + eng->curoff, n);
+			iovoff += n;
+			copied += n;
+			eng->curoff += n;
+			eng->curlen -= n;
+			if (eng->curlen == 0) {
+				rx_recycle(eng, eng->curbid);
+				eng->curbid = -1;
+			}
+			continue;
+		}
+		if (eng->eof || eng->error)
+			break;
+
+		if (!eng->armed)
+			rx_arm(eng);
+		if (!uring_cqe(&eng->rx, &cqe)) {
+			if (copied > 0)
+				break;
+			if (nonblock) {
+				if (uring_submit(&eng->rx, syscalls) < 0) {
+					eng->error = errno;
+					break;
+				}
+				errno = EAGAIN;
+				return -1;
+			}
+			if (uring_wait(&eng->rx, syscalls) < 0 && errno != EINTR) {
+				eng->error = errno;
+				break;
+			}
+			continue;
+		}
+
+		if (!(cqe.flags & IORING_CQE_F_MORE))
+			eng->armed = 0;
+		if (cqe.res > 0) {
+			eng->curbid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+			eng->curoff = 0;
+			eng->curlen = cqe.res;
+		}
+		else if (cqe.res == 0) {
+			eng->eof = 1;
+		}
+		else if (cqe.res == -EINVAL && eng->multishot) {
+			//the kernel predates multishot recv, arm one recv per completion instead
+			eng->multishot = 0;
+		}
+		else if (cqe.res != -ENOBUFS && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+			eng->error = -cqe.res;
+		}
+	}
+
+	if (copied > 0)
+		return copied;
+	if (eng->eof)
+		return 0;
+	errno = eng->error;
+	return -1;
+}
+
+// Pseudocode
+// 1) Copy as much of the iovec array as fits into the registered send buffer
+// 2) Write it with IORING_OP_WRITE_FIXED and wait for the completion, writing the rest again
+//    after a partial write
+// 3) Repeat until the whole array is written
+//
+long uring_engine_writev(uring_engine_t* eng, const struct iovec* iov, int iovcnt, unsigned long* syscalls) {
+	long total = 0;
+	int idx = 0;
+	size_t iovoff = 0;
+	struct io_uring_cqe cqe;
+
+	while (idx < iovcnt) {
+		//gather the next chunk into the registered buffer
+		size_t len = 0;
+		while (idx < iovcnt && len < URING_TXBUF_SIZE) {
+			size_t n = iov[idx].iov_len - iovoff;
+			if (n > URING_TXBUF_SIZE - len)
+				n = URING_TXBUF_SIZE - len;
+			memcpy(eng->txbuf + len, (char*)iov[idx].iov_base + iovoff, n);
+			len += n;
+			iovoff += n;
+			if (iovoff == iov[idx].iov_len) {
+				idx++;
+				iovoff = 0;
+			}
+		}
+
+		size_t off = 0;
+		while (off < len) {
+			struct io_uring_sqe* sqe = uring_sqe(&eng->tx);
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->fd = eng->connection;
+			sqe->addr = (unsigned long)(eng->txbuf + off);
+			sqe->len = len - off;
+			sqe->buf_index = 0;
+			while (!uring_cqe(&eng->tx, &cqe)) {
+				if (uring_wait(&eng->tx, syscalls) < 0 && errno != EINTR)
+					return -1;
+			}
+			if (cqe.res < 0) {
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+					continue;
+				errno = -cqe.res;
+				return -1;
+			}
+			if (cqe.res == 0) {
+				errno = EPIPE;
+				return -1;
+			}
+			off += cqe.res;
+			total += cqe.res;
+		}
+	}
+	return total;
+}
@@ -0,0 +1,52 @@
+//
+// FILE: snp_uring.h
+//
+// Description: This file contains the io_uring I/O engine the SNP layer can use for a stream
+// overlay connection instead of blocking recv()/sendmsg() calls. Every engine owns two rings,
+// one for the receiving thread and one for the senders, so neither shares a completion queue
+// with the other.
+//
+// Receiving arms a single multishot recv on the connection. The kernel keeps filling the
+// engine's provided buffers as data arrives and posts one completion for each, so the receive
+// ring only enters the kernel when its completion queue is empty. Sending copies the framed
+// segments into a buffer registered with the ring and writes it with IORING_OP_WRITE_FIXED,
+// so the kernel does not have to map the pages of every batch.
+//
+
+#ifndef SNP_URING_H
+#define SNP_URING_H
+
+#include <sys/uio.h>
+
+typedef struct uring_engine uring_engine_t;
+
+// Set up the rings, the provided receive buffers and the registered send buffer for the
+// overlay connection. Returns NULL if io_uring is unavailable or any step fails; the caller
+// then keeps using plain syscalls.
+//
+uring_engine_t* uring_engine_create(int connection);
+
+// Tear down the rings and release the buffers.
+//
+void uring_engine_destroy(uring_engine_t* eng);
+
+// Read like readv(): wait until at least one byte has arrived, then copy as many bytes as the
+// completions already posted hold into the iovec array without waiting again. With nonblock
+// set it fails with EAGAIN instead of waiting. *syscalls is increased by the io_uring_enter()
+// calls made. Returns the number of bytes copied, 0 on end of stream and -1 on error.
+//
+int uring_engine_readv(uring_engine_t* eng, const struct iovec* iov, int iovcnt, int nonblock, unsigned long* syscalls);
+
+// Make sure the recv is armed and submitted, and return the descriptor of the receive ring.
+// It is readable whenever completions are waiting, so an event loop can wait on it instead
+// of the overlay socket, which the engine drains on its own.
+//
+int uring_engine_pollfd(uring_engine_t* eng, unsigned long* syscalls);
+
+// Write the whole iovec array to the overlay through the registered send buffer, continuing
+// after partial writes. *syscalls is increased by the io_uring_enter() calls made.
+// Returns the number of bytes written and -1 on error.
+//
+long uring_engine_writev(uring_engine_t* eng, const struct iovec* iov, int iovcnt, unsigned long* syscalls);
+
+#endif
@@ -0,0 +1,94 @@
+//FILE: server/app_multi_server.c
+//
+//Description: this is the server side of the overlay scaling benchmark. The server initializes the SRT server by calling srt_server_init() and lets it accept overlay TCP connections from any number of client hosts by calling srt_server_listen(). It creates one SRT socket per expected client, all on server port SVRPORT1, and accepts them by calling srt_server_sock() and srt_server_accept(). Each connection ends up on the overlay connection of its client. It then receives one message of MSGLEN bytes from every connection, checks it, reports the aggregate rate, and closes the sockets by calling srt_server_close().
+
+//Input: the number of client hosts to serve (default CONNECTIONS) as the first argument
+
+//Output: SRT server states and the benchmark result
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../common/constants.h"
+#include "../common/slab.h"
+#include "srt_server.h"
+
+//every client host connects to server port SVRPORT1 on its own overlay connection
+#define SVRPORT1 88
+//number of client hosts served when no argument is given
+#define CONNECTIONS 100
+//length of the message every client sends, the client app uses the same value
+#define MSGLEN 4096
+
+int main(int argc, char* argv[]) {
+	int connections = argc > 1 ? atoi(argv[1]) : CONNECTIONS;
+	if(connections <= 0 || connections > MAX_TRANSPORT_CONNECTIONS) {
+		printf("usage: %s [connections], at most %d\n", argv[0], MAX_TRANSPORT_CONNECTIONS);
+		exit(1);
+	}
+
+	//every connection takes an overlay socket and a timer descriptor
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	//initialize srt server and accept overlay connections
+	srt_server_init(-1);
+	if(srt_server_listen(OVERLAY_PORT)<0) {
+		printf("can not start overlay\n");
+		exit(1);
+	}
+
+	//create a srt server sock for every client and accept its connection
+	int* sockfds = malloc(connections * sizeof(int));
+	for(int i = 0; i < connections; i++) {
+		sockfds[i] = srt_server_sock(SVRPORT1);
+		if(sockfds[i]<0) {
+			printf("can't create srt server\n");
+			exit(1);
+		}
+		srt_server_accept(sockfds[i]);
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	//receive one message from every connection
+	char* buf = malloc(MSGLEN + 1);
+	int bad = 0;
+	for(int i = 0; i < connections; i++) {
+		if(srt_server_recv(sockfds[i], buf, MSGLEN + 1)<0) {
+			bad++;
+			continue;
+		}
+		for(int j = 1; j < MSGLEN; j++) {
+			if(buf[j] != buf[0]) {
+				bad++;
+				break;
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(buf);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d overlay connections: received %d bytes in %.3f s (%.3f MB/s), %d bad messages\n",
+		connections, connections * MSGLEN, secs, connections * MSGLEN / secs / 1e6, bad);
+
+	//close srt server socks
+	for(int i = 0; i < connections; i++) {
+		if(srt_server_close(sockfds[i])<0) {
+			printf("can't destroy srt server\n");
+			exit(1);
+		}
+	}
+	free(sockfds);
+	slab_print();
+	return bad == 0 ? 0 : 1;
+}
@@ -1,6 +1,6 @@
 //FILE: server/app_simple_server.c
 
-//Description: this is the simple server application code. The server first starts the overlay by creating a direct TCP link between the client and the server. Then it initializes the SRT server by calling srt_svr_init(). It creates 2 sockets and waits for connection from the client by calling srt_svr_sock() and srt_svr_connect() twice. The server then receives short strings sent from the client from both connections. Finally the server closes the socket by calling srt_server_close(). Overlay is stopped by calling overlay_end().
+//Description: this is the simple server application code. The server first initializes the SRT server by calling srt_svr_init() and lets it accept the overlay TCP connection from the client by calling srt_server_listen(). It creates 2 sockets and waits for connection from the client by calling srt_svr_sock() and srt_svr_connect() twice. The server then receives short strings sent from the client from both connections. Finally the server closes the socket by calling srt_server_close(). The overlay connection is closed by the SRT server when the client hangs up.
 
 //Date: April 26,2008
 
@@ -30,51 +30,17 @@
 //after the strings are received, the server waits WAITTIME seconds, and then closes the connections
 #define WAITTIME 10
 
-//this function starts the overlay by creating a direct TCP connection between the client and the server. The TCP socket descriptor is returned. If the TCP connection fails, return -1. The TCP socket descriptor returned will be used by SRT to send segments.
-int overlay_start() {
-	int tcpserv_sd;
-	struct sockaddr_in tcpserv_addr;
-	int connection;
-	struct sockaddr_in tcpclient_addr;
-	socklen_t tcpclient_addr_len;
-
-	tcpserv_sd = socket(AF_INET, SOCK_STREAM, 0); 
-	if(tcpserv_sd<0) 
-		return -1;
-	memset(&tcpserv_addr, 0, sizeof(tcpserv_addr));
-	tcpserv_addr.sin_family = AF_INET;
-	tcpserv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	tcpserv_addr.sin_port = htons(OVERLAY_PORT);
-
-	if(bind(tcpserv_sd, (struct sockaddr *)&tcpserv_addr, sizeof(tcpserv_addr))< 0)
-		return -1; 
-	if(listen(tcpserv_sd, 1) < 0) 
-		return -1;
-	printf("waiting for connection\n");
-	connection = accept(tcpserv_sd,(struct sockaddr*)&tcpclient_addr,&tcpclient_addr_len);
-	return connection;
-
-}
-
-//this function stops the overlay by closing the TCP connection between the server and the client
-void overlay_stop(int connection) {
-	close(connection);
-}
-
 int main() {
 	//random seed for segment loss
 	srand(time(NULL));
 
-	//start overlay and get the overlay TCP socket descriptor
-	int overlay_conn = overlay_start();
-	if(overlay_conn<0) {
+	//initialize srt server and accept overlay connections
+	srt_server_init(-1);
+	if(srt_server_listen(OVERLAY_PORT)<0) {
 		printf("can not start overlay\n");
 		exit(1);
 	}
 
-	//initialize srt server
-	srt_server_init(overlay_conn);
-
 	//create a srt server sock at port SVRPORT1 
 	int sockfd= srt_server_sock(SVRPORT1);
 	if(sockfd<0) {
@@ -119,7 +85,4 @@ int main() {
 		printf("can't destroy srt server\n");
 		exit(1);
 	}				
-
-	//stop the overlay
-	overlay_stop(overlay_conn);
 }
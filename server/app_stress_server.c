@@ -1,6 +1,6 @@
 //FILE: server/app_stress_server.c
 
-//Description: this is the stress server application code. The server first starts the overlay by creating a direct TCP link between the client and the server. Then it initializes the SRT server by calling srt_svr_init(). It creates a sockets and waits for connection from the client by calling srt_svr_sock() and srt_svr_connect(). It then receives the length of the file to be received. After that, it creates a buffer, receives the file data and saves the file data to receivedtext.txt file. Finally the server closes the socket by calling srt_server_close(). Overlay is stopped by calling overlay_end().
+//Description: this is the stress server application code. The server first initializes the SRT server by calling srt_svr_init() and lets it accept the overlay TCP connection from the client by calling srt_server_listen(); with a udp or shm overlay it starts the overlay itself and hands it to srt_svr_init(). It creates a sockets and waits for connection from the client by calling srt_svr_sock() and srt_svr_connect(). It then receives the length of the file to be received. After that, it creates a buffer, receives the file data and saves the file data to receivedtext.txt file; a length of -1 announces the generated stream of the client's SRT_STRESS_BYTES mode instead, which it checks as it arrives, see recv_stream(). Finally the server closes the socket by calling srt_server_close(). The overlay connection is closed by the SRT server when the client hangs up.
 
 //Date: April 26,2008
 
@@ -18,8 +18,10 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
+#include <sys/resource.h>
 
 #include "../common/constants.h"
+#include "../common/slab.h"
 #include "srt_server.h"
 
 //One SRT connection is created using client port CLIENTPORT1 and server port SVRPORT1. 
@@ -27,6 +29,40 @@
 #define SVRPORT1 88
 //after the received file data is saved, the server waits WAITTIME seconds, and then closes the connection
 #define WAITTIME 10
+//the generated stream is received STREAM_CHUNK bytes at a time, the chunk size of the client
+#define STREAM_CHUNK 65536
+//srt_server_recv() calls of the stream are timed in RECV_FILL_BUCKETS buckets by how full the receive buffer is
+#define RECV_FILL_BUCKETS 4
+
+//if the SRT_OVERLAY environment variable is set to udp, the overlay is a UDP socket instead. It waits for the client's first datagram and connects the socket to the client, so every segment travels in its own datagram.
+int overlay_start_udp() {
+	int udp_sd;
+	struct sockaddr_in udpserv_addr;
+	struct sockaddr_in udpclient_addr;
+	socklen_t udpclient_addr_len = sizeof(udpclient_addr);
+	char c;
+
+	udp_sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(udp_sd<0)
+		return -1;
+	int bufsize = OVERLAY_UDP_BUFSIZE;
+	setsockopt(udp_sd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setsockopt(udp_sd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	memset(&udpserv_addr, 0, sizeof(udpserv_addr));
+	udpserv_addr.sin_family = AF_INET;
+	udpserv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	udpserv_addr.sin_port = htons(OVERLAY_PORT);
+
+	if(bind(udp_sd, (struct sockaddr *)&udpserv_addr, sizeof(udpserv_addr))< 0)
+		return -1;
+	printf("waiting for connection\n");
+	//peek at the first datagram to learn the client address, it stays queued for SRT
+	if(recvfrom(udp_sd, &c, 1, MSG_PEEK, (struct sockaddr*)&udpclient_addr, &udpclient_addr_len) < 0)
+		return -1;
+	if(connect(udp_sd, (struct sockaddr*)&udpclient_addr, udpclient_addr_len) < 0)
+		return -1;
+	return udp_sd;
+}
 
 //this function starts the overlay by creating a direct TCP connection between the client and the server. The TCP socket descriptor is returned. If the TCP connection fails, return -1. The TCP socket descriptor returned will be used by SRT to send segments.
 int overlay_start() {
@@ -39,6 +75,8 @@ int overlay_start() {
 	tcpserv_sd = socket(AF_INET, SOCK_STREAM, 0); 
 	if(tcpserv_sd<0) 
 		return -1;
+	int on = 1;
+	setsockopt(tcpserv_sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 	memset(&tcpserv_addr, 0, sizeof(tcpserv_addr));
 	tcpserv_addr.sin_family = AF_INET;
 	tcpserv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -54,23 +92,88 @@ int overlay_start() {
 
 }
 
-//this function stops the overlay by closing the TCP connection between the server and the client
-void overlay_stop(int connection) {
-	close(connection);
+//receive the generated stream the client sends when its file length is -1: its length, then
+//bytes whose every 8-byte word holds its own offset in the stream. Returns the bytes received.
+//It also times every srt_server_recv() call whose data has already arrived, which is the cost
+//of copying it out, by how full the receive buffer is. SRT_STRESS_PAUSE sets microseconds to
+//sleep after every chunk, so that a slow reader lets the buffer fill up.
+unsigned long long recv_stream(int sockfd) {
+	unsigned long long total, off;
+	unsigned long bad = 0;
+	unsigned long calls[RECV_FILL_BUCKETS] = {0};
+	double nsecs[RECV_FILL_BUCKETS] = {0};
+	int pause = getenv("SRT_STRESS_PAUSE") ? atoi(getenv("SRT_STRESS_PAUSE")) : 0;
+	char totals[sizeof(total) + 1];
+	srt_server_recv(sockfd, totals, sizeof(totals));
+	memcpy(&total, totals, sizeof(total));
+
+	char* buf = malloc(STREAM_CHUNK + 1);
+	unsigned long long* expect = malloc(STREAM_CHUNK);
+	assert(buf != NULL && expect != NULL);
+	for(off = 0; off < total; off += STREAM_CHUNK) {
+		unsigned int n = total - off < STREAM_CHUNK ? total - off : STREAM_CHUNK;
+		unsigned long long received, read;
+		struct timespec start, end;
+		srt_server_getoffsets(sockfd, &received, &read);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if(srt_server_recv(sockfd, buf, n + 1) < 0) {
+			printf("stream broken at offset %llu\n", off);
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if(received - read >= n) {
+			int b = (received - read) * RECV_FILL_BUCKETS / RECEIVE_BUF_SIZE;
+			calls[b]++;
+			nsecs[b] += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		}
+		if(pause > 0)
+			usleep(pause);
+		for(unsigned int i = 0; i < STREAM_CHUNK / 8; i++)
+			expect[i] = off + i * 8;
+		if(memcmp(buf, expect, n) != 0) {
+			if(bad++ == 0)
+				printf("stream differs from the pattern at offset %llu\n", off);
+		}
+	}
+	printf("stream: %llu of %llu bytes received, %lu chunks differ from the pattern\n", off < total ? off : total, total, bad);
+	for(int b = 0; b < RECV_FILL_BUCKETS; b++) {
+		if(calls[b] > 0)
+			printf("recv of %d bytes with the receive buffer %d-%d%% full: %.2f us per call over %lu calls\n", STREAM_CHUNK, b * 100 / RECV_FILL_BUCKETS, (b + 1) * 100 / RECV_FILL_BUCKETS, nsecs[b] / calls[b] / 1e3, calls[b]);
+	}
+	free(expect);
+	free(buf);
+	return off < total ? off : total;
 }
 
 int main() {
 	//random seed for segment loss
 	srand(time(NULL));
 
-	//start overlay and get the overlay TCP socket descriptor
-	int overlay_conn = overlay_start();
-	if(overlay_conn<0) {
-		printf("can not start overlay\n");
+	//start a udp or shm overlay here and get its socket descriptor,
+	//a TCP overlay is accepted by the srt server itself
+	char* overlay = getenv("SRT_OVERLAY");
+	int udp = overlay != NULL && strcmp(overlay, "udp") == 0;
+	int shm = overlay != NULL && strcmp(overlay, "shm") == 0;
+	int overlay_conn = -1;
+	if(udp || shm) {
+		overlay_conn = udp ? overlay_start_udp() : overlay_start();
+		if(overlay_conn<0) {
+			printf("can not start overlay\n");
+			exit(1);
+		}
+	}
+	//with SRT_OVERLAY=shm the client runs on this host and segments go through shared memory
+	if(shm && snp_shm_start(overlay_conn, 1) < 0) {
+		printf("can not start shared memory overlay\n");
+		exit(1);
 	}
 
 	//initialize srt server
 	srt_server_init(overlay_conn);
+	if(!udp && !shm && srt_server_listen(OVERLAY_PORT)<0) {
+		printf("can not start overlay\n");
+		exit(1);
+	}
 
 	//create a srt server sock at port SVRPORT1 
 	int sockfd= srt_server_sock(SVRPORT1);
@@ -80,23 +183,61 @@ int main() {
 	}
 	//listen and accept connection from a srt client 
 	srt_server_accept(sockfd);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	//receive the file size first 
+	//receive the file size first, sent as a binary int,
 	//and then receive the file data
 	int fileLen;
-	char fileLens[4];
-	srt_server_recv(sockfd,&fileLens, 5);
-	fileLen = atoi(fileLens);
-
-	char* buf = (char*) malloc(fileLen);
-	srt_server_recv(sockfd,buf,fileLen + 1);
+	char fileLens[sizeof(int) + 1];
+	srt_server_recv(sockfd,fileLens, sizeof(fileLens));
+	memcpy(&fileLen, fileLens, sizeof(int));
+
+	char* buf = NULL;
+	unsigned long long received = fileLen;
+	if(fileLen < 0) {
+		received = recv_stream(sockfd);
+	}
+	else {
+		buf = (char*) malloc(fileLen + 1);
+		srt_server_recv(sockfd,buf,fileLen + 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	//report overlay receive statistics
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	snp_stats_t stats;
+	overlay_conn = srt_server_getconn(sockfd);
+	snp_getstats(overlay_conn, &stats);
+	printf("received %llu bytes in %.3f s (%.3f MB/s)\n", received, secs, received / secs / 1e6);
+	unsigned long long inorder, read;
+	srt_server_getoffsets(sockfd, &inorder, &read);
+	printf("stream offsets: %llu bytes received in order, %llu read\n", inorder, read);
+	printf("overlay: %lu segments, %lu bytes, %lu receive syscalls (%.2f per segment)\n",
+		stats.rx_segs, stats.rx_bytes, stats.rx_syscalls,
+		stats.rx_segs ? (double)stats.rx_syscalls / stats.rx_segs : 0.0);
+	printf("impairment: %lu lost, %lu corrupted, %lu duplicated, %lu bad checksums\n",
+		stats.rx_lost, stats.rx_corrupted, stats.rx_duplicated, stats.rx_badsum);
+	srt_ackstats_t acks;
+	srt_server_getackstats(sockfd, &acks);
+	printf("acks: %lu DATA segments, %lu DATAACKs (%.2f per segment), %lu sent by the delayed ACK timer\n",
+		acks.data, acks.acks, acks.data ? (double)acks.acks / acks.data : 0.0, acks.delayed);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("cpu: %.3f s user, %.3f s system\n",
+		usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6, usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+	printf("checksum kernel: %s\n", checksum_kernel());
+	printf("io engine: %s\n", snp_getengine(overlay_conn) == SNP_ENGINE_URING ? "io_uring" : "syscall");
+	slab_print();
 
 	//save the received file data in receivedtext.txt
-	FILE* f;
-	f = fopen("receivedtext.txt","a");
-	fwrite(buf,fileLen,1,f);
-	fclose(f);
-	free(buf);
+	if(buf != NULL) {
+		FILE* f;
+		f = fopen("receivedtext.txt","a");
+		fwrite(buf,fileLen,1,f);
+		fclose(f);
+		free(buf);
+	}
 
 	//wait for a while
 	sleep(WAITTIME);
@@ -106,7 +247,4 @@ int main() {
 		printf("can't destroy srt server\n");
 		exit(1);
 	}				
-
-	//stop the overlay
-	overlay_stop(overlay_conn);
 }
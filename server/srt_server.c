@@ -6,6 +6,7 @@
 // Date: April 27, 2016
 // Author: Victoria Taylor (skeleton code provided by Prof. Xia Zhou)
 //
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <stdio.h>
@@ -13,7 +14,11 @@
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
 #include "srt_server.h"
+#include "../common/slab.h"
 
 //
 //
@@ -32,14 +37,367 @@
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 
+//number of chains in the demultiplexing hash, must be a power of 2
+#define TCB_HASH_SIZE 2048
+
 struct svr_tcb *serverTCB[MAX_TRANSPORT_CONNECTIONS];
-int serverconn;
 
-// This function initializes the TCB table marking all entries NULL. It also initializes 
-// a global variable for the overlay TCP socket descriptor ``conn'' used as input parameter
-// for snp_sendseg and snp_recvseg. Finally, the function starts the seghandler thread to 
-// handle the incoming segments. There is only one seghandler for the server side which
-// handles call connections for the client.
+// Connected TCBs hashed by (overlay connection, client port, server port)
+static struct svr_tcb *tcbHash[TCB_HASH_SIZE];
+
+// A SYN that arrived while no TCB was listening on its server port
+typedef struct syn_pending {
+	int conn;
+	unsigned int client_port;
+	unsigned int svr_port;
+	unsigned int mss;               //segment size agreed for it, see syn_mss()
+} syn_pending_t;
+static syn_pending_t synBacklog[SYN_BACKLOG];
+static int synBacklogLen = 0;
+
+// A TCB comes from tcbPool together with its mutex and condition, and its receive buffer
+// from recvPool
+typedef struct svr_tcb_obj {
+	struct svr_tcb tcb;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} svr_tcb_obj_t;
+static slab_pool_t *tcbPool;
+static slab_pool_t *recvPool;
+
+// In-order DATA segments per DATAACK of new sockets, set by SRT_DELACK
+static unsigned int delackSegs = DELACK_SEGS;
+
+// Protects serverTCB, tcbHash and synBacklog. It is taken before a TCB's bufMutex.
+static pthread_mutex_t tableMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Segments from the overlay are received here by seghandler; it has room for any the overlay carries
+static SEGBUF(JUMBO_SEG_LEN) rxSeg;
+
+// Replies built by seghandler are queued here and sent with one snp_sendseg_batch()
+// once every segment waiting on the overlay has been handled. A reply never carries more
+// than a DATAACK's selective ACK blocks.
+static SEGBUF(MAX_SEG_LEN) replyQueue[SNP_MAX_BATCH];
+static seg_t *replyPtrs[SNP_MAX_BATCH];
+static int replyNum = 0;
+
+// Send all queued replies to the overlay connection in one burst
+static int reply_flush(int conn)
+{
+	int n = replyNum;
+	replyNum = 0;
+	if (n == 0){
+		return 1;
+	}
+	return snp_sendseg_batch(conn, replyPtrs, n);
+}
+
+// Queue a reply segment, flushing the queue when it is full
+static int reply_queue(int conn, seg_t *seg)
+{
+	seg_t *reply = &replyQueue[replyNum].seg;
+	reply->header = seg->header;
+	memcpy(reply->data, seg->data, seg->header.length);
+	reply->header.checksum = checksum(reply);
+	replyPtrs[replyNum] = reply;
+	replyNum++;
+	if (replyNum == SNP_MAX_BATCH){
+		return reply_flush(conn);
+	}
+	return 1;
+}
+
+// Copy len bytes into the receive ring, starting at offset at past its read cursor, in at most
+// two pieces when they wrap around the end of recvBuf. Called with the TCB's mutex held.
+static void ring_put(struct svr_tcb *tcb, unsigned int at, const char* data, unsigned int len)
+{
+	unsigned int pos = tcb->readPos + at;
+	if (pos >= RECEIVE_BUF_SIZE){
+		pos -= RECEIVE_BUF_SIZE;
+	}
+	unsigned int first = RECEIVE_BUF_SIZE - pos;
+	if (len <= first){
+		memcpy(tcb->recvBuf + pos, data, len);
+		return;
+	}
+	memcpy(tcb->recvBuf + pos, data, first);
+	memcpy(tcb->recvBuf, data + first, len - first);
+}
+
+// Store a DATA segment in the receive ring. A byte with sequence number seq goes to offset
+// usedBufLen + (seq - expect_seqNum) past the read cursor, so a segment that arrives out of order is
+// written straight to where it will be read and only its range is recorded in sack. When the
+// segment at expect_seqNum arrives, expect_seqNum and usedBufLen advance over it and over every
+// range it joins. Sequence numbers are compared by their offset from expect_seqNum.
+// Returns 1 if the segment was stored or was already held, and 0 if it was dropped because it
+// does not fit in the receive buffer or would need more than SACK_MAX_BLOCKS ranges.
+// Called with the TCB's mutex held.
+static int reasm_add(struct svr_tcb *tcb, seg_t *seg)
+{
+	unsigned int start = seg->header.seq_num - tcb->expect_seqNum;
+	unsigned int end = start + seg->header.length;
+	unsigned int i;
+
+	// Already delivered in order
+	if (SEQ_LT(seg->header.seq_num, tcb->expect_seqNum)){
+		return 1;
+	}
+	if (tcb->usedBufLen + end >= RECEIVE_BUF_SIZE){
+		return 0;
+	}
+
+	// Find the first range that ends at or after the segment starts
+	for (i = 0; i < tcb->sackNum && tcb->sack[i].end - tcb->expect_seqNum < start; i++);
+	if (i < tcb->sackNum && tcb->sack[i].start - tcb->expect_seqNum <= start
+			&& tcb->sack[i].end - tcb->expect_seqNum >= end){
+		return 1;
+	}
+	if (start > 0 && (i == tcb->sackNum || tcb->sack[i].start - tcb->expect_seqNum > end)
+			&& tcb->sackNum == SACK_MAX_BLOCKS){
+		return 0;
+	}
+	ring_put(tcb, tcb->usedBufLen + start, seg->data, seg->header.length);
+
+	if (start == 0){
+		// In order: deliver it and every range it now reaches
+		unsigned int expect = tcb->expect_seqNum;
+		tcb->expect_seqNum += end;
+		tcb->usedBufLen += end;
+		while (tcb->sackNum > 0 && SEQ_LEQ(tcb->sack[0].start, tcb->expect_seqNum)){
+			if (SEQ_GT(tcb->sack[0].end, tcb->expect_seqNum)){
+				tcb->usedBufLen += tcb->sack[0].end - tcb->expect_seqNum;
+				tcb->expect_seqNum = tcb->sack[0].end;
+			}
+			memmove(&tcb->sack[0], &tcb->sack[1], --tcb->sackNum * sizeof(srt_sack_t));
+		}
+		tcb->rcvOffset += tcb->expect_seqNum - expect;
+		return 1;
+	}
+
+	// Out of order: merge it into range i and its successors, or insert a new range before i
+	unsigned int seqStart = seg->header.seq_num;
+	unsigned int seqEnd = seqStart + seg->header.length;
+	if (i < tcb->sackNum && tcb->sack[i].start - tcb->expect_seqNum <= end){
+		if (tcb->sack[i].start - tcb->expect_seqNum > start){
+			tcb->sack[i].start = seqStart;
+		}
+		if (tcb->sack[i].end - tcb->expect_seqNum < end){
+			tcb->sack[i].end = seqEnd;
+		}
+		while (i + 1 < tcb->sackNum && tcb->sack[i + 1].start - tcb->expect_seqNum <= tcb->sack[i].end - tcb->expect_seqNum){
+			if (tcb->sack[i + 1].end - tcb->expect_seqNum > tcb->sack[i].end - tcb->expect_seqNum){
+				tcb->sack[i].end = tcb->sack[i + 1].end;
+			}
+			memmove(&tcb->sack[i + 1], &tcb->sack[i + 2], (--tcb->sackNum - i - 1) * sizeof(srt_sack_t));
+		}
+	}
+	else{
+		memmove(&tcb->sack[i + 1], &tcb->sack[i], (tcb->sackNum - i) * sizeof(srt_sack_t));
+		tcb->sack[i].start = seqStart;
+		tcb->sack[i].end = seqEnd;
+		tcb->sackNum++;
+	}
+	return 1;
+}
+
+// Return the receive window to advertise in rcv_win: the bytes beyond expect_seqNum that fit
+// in the receive buffer, in units of 1 << RCV_WIN_SHIFT rounded down, and remember it as the
+// last window advertised. Called with the TCB's mutex held.
+static unsigned short rcv_win(struct svr_tcb *tcb)
+{
+	unsigned int win = (RECEIVE_BUF_SIZE - 1 - tcb->usedBufLen) >> RCV_WIN_SHIFT;
+	tcb->rcvWin = win << RCV_WIN_SHIFT;
+	return win;
+}
+
+// Build in seg a DATAACK for everything the TCB holds in order, with the out-of-order ranges as
+// selective ACK blocks and the receive window. It acknowledges the segments waiting for a
+// delayed ACK too, so their timer is cancelled. Called with the TCB's mutex held.
+static void ack_build(struct svr_tcb *tcb, seg_t *seg)
+{
+	memset(&seg->header, 0, sizeof(srt_hdr_t));
+	seg->header.src_port = tcb->svr_portNum;
+	seg->header.dest_port = tcb->client_portNum;
+	seg->header.type = DATAACK;
+	seg->header.seq_num = tcb->expect_seqNum;
+	seg->header.length = tcb->sackNum * sizeof(srt_sack_t);
+	memcpy(seg->data, tcb->sack, seg->header.length);
+	seg->header.rcv_win = rcv_win(tcb);
+	if (tcb->ackPending > 0){
+		tcb->ackPending = 0;
+		evloop_timer_set(tcb->ackTimer, 0);
+	}
+	tcb->acks.acks++;
+}
+
+// Segment size agreed for a SYN from the overlay connection: what the client proposes in its
+// data, MAX_SEG_LEN if it proposes nothing, lowered to what the overlay carries
+static unsigned int syn_mss(int conn, seg_t *seg)
+{
+	srt_synopt_t opt = { MAX_SEG_LEN };
+	if (seg->header.length >= sizeof(srt_synopt_t)){
+		memcpy(&opt, seg->data, sizeof(srt_synopt_t));
+	}
+	int maxseg = snp_getmaxseg(conn);
+	if (maxseg > 0 && opt.mss > (unsigned int)maxseg){
+		opt.mss = maxseg;
+	}
+	if (opt.mss < MAX_SEG_LEN){
+		opt.mss = MAX_SEG_LEN;
+	}
+	return opt.mss;
+}
+
+// Build in seg the SYNACK of the TCB, which answers the SYN with the agreed segment size
+// and advertises the receive window. Called with the TCB's mutex held.
+static void synack_build(struct svr_tcb *tcb, seg_t *seg)
+{
+	srt_synopt_t opt = { tcb->mss };
+	memset(&seg->header, 0, sizeof(srt_hdr_t));
+	seg->header.src_port = tcb->svr_portNum;
+	seg->header.dest_port = tcb->client_portNum;
+	seg->header.ack_num = 1;
+	seg->header.type = SYNACK;
+	seg->header.length = sizeof(srt_synopt_t);
+	memcpy(seg->data, &opt, sizeof(srt_synopt_t));
+	seg->header.rcv_win = rcv_win(tcb);
+}
+
+static unsigned int tcb_hashkey(int conn, unsigned int client_port, unsigned int svr_port)
+{
+	unsigned int h = (unsigned int)conn * 2654435761u;
+	h ^= client_port * 40503u + svr_port;
+	return (h ^ (h >> 16)) & (TCB_HASH_SIZE - 1);
+}
+
+// Bind the TCB to the overlay connection and client port of a SYN. Called with tableMutex held.
+static void tcb_bind(struct svr_tcb *tcb, int conn, unsigned int client_port)
+{
+	unsigned int h = tcb_hashkey(conn, client_port, tcb->svr_portNum);
+	tcb->overlay_conn = conn;
+	tcb->client_portNum = client_port;
+	tcb->hashNext = tcbHash[h];
+	tcbHash[h] = tcb;
+}
+
+// Take the TCB out of the hash once it is closed. Called with tableMutex held.
+static void tcb_unbind(struct svr_tcb *tcb)
+{
+	if (tcb->overlay_conn < 0){
+		return;
+	}
+	struct svr_tcb **p = &tcbHash[tcb_hashkey(tcb->overlay_conn, tcb->client_portNum, tcb->svr_portNum)];
+	while (*p != NULL && *p != tcb){
+		p = &(*p)->hashNext;
+	}
+	if (*p != NULL){
+		*p = tcb->hashNext;
+	}
+	tcb->hashNext = NULL;
+	tcb->overlay_conn = -1;
+}
+
+// Find the TCB a segment from the overlay connection belongs to. A SYN that matches no
+// connected TCB goes to a TCB listening on its server port. Called with tableMutex held.
+static struct svr_tcb *tcb_lookup(int conn, seg_t *seg)
+{
+	struct svr_tcb *tcb = tcbHash[tcb_hashkey(conn, seg->header.src_port, seg->header.dest_port)];
+	for (; tcb != NULL; tcb = tcb->hashNext){
+		if (tcb->overlay_conn == conn && tcb->client_portNum == seg->header.src_port
+				&& tcb->svr_portNum == seg->header.dest_port){
+			return tcb;
+		}
+	}
+	if (seg->header.type != SYN){
+		return NULL;
+	}
+	for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
+		tcb = serverTCB[i];
+		if (tcb != NULL && tcb->state == LISTENING && tcb->svr_portNum == seg->header.dest_port){
+			return tcb;
+		}
+	}
+	return NULL;
+}
+
+// Keep a SYN no TCB is listening for, so srt_server_accept() can take it later. Client
+// retransmissions of a SYN already held are not added again. Called with tableMutex held.
+static void syn_backlog_add(int conn, seg_t *seg)
+{
+	for (int i = 0; i < synBacklogLen; i++){
+		if (synBacklog[i].conn == conn && synBacklog[i].client_port == seg->header.src_port
+				&& synBacklog[i].svr_port == seg->header.dest_port){
+			return;
+		}
+	}
+	if (synBacklogLen == SYN_BACKLOG){
+		return;
+	}
+	synBacklog[synBacklogLen].conn = conn;
+	synBacklog[synBacklogLen].client_port = seg->header.src_port;
+	synBacklog[synBacklogLen].svr_port = seg->header.dest_port;
+	synBacklog[synBacklogLen].mss = syn_mss(conn, seg);
+	synBacklogLen++;
+}
+
+// The peer of an overlay connection has gone away: close the TCBs bound to it, forget its
+// SYNs and release the connection. Called on the loop thread.
+static void overlay_drop(int conn)
+{
+	pthread_mutex_lock(&tableMutex);
+	for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
+		struct svr_tcb *tcb = serverTCB[i];
+		if (tcb != NULL && tcb->overlay_conn == conn){
+			pthread_mutex_lock(tcb->bufMutex);
+			evloop_timer_set(tcb->closeTimer, 0);
+			evloop_timer_set(tcb->ackTimer, 0);
+			tcb->state = CLOSED;
+			tcb_unbind(tcb);
+			pthread_cond_broadcast(tcb->bufCond);
+			pthread_mutex_unlock(tcb->bufMutex);
+		}
+	}
+	for (int i = 0; i < synBacklogLen; ){
+		if (synBacklog[i].conn == conn){
+			synBacklog[i] = synBacklog[--synBacklogLen];
+		}
+		else{
+			i++;
+		}
+	}
+	pthread_mutex_unlock(&tableMutex);
+
+	evloop_del_fd(snp_getpollfd(conn));
+	snp_release(conn);
+	close(conn);
+}
+
+// Hand an overlay connection to the event loop
+static int overlay_add(int conn)
+{
+	return evloop_add_fd(snp_getpollfd(conn), seghandler, (void *)(long)conn);
+}
+
+// Accept the overlay connections waiting on the listening socket, OVERLAY_ACCEPT_BATCH at a
+// time; the event loop calls it again while more are waiting
+static void overlay_accept(void *arg)
+{
+	int listenfd = (int)(long)arg;
+	int conn;
+
+	for (int i = 0; i < OVERLAY_ACCEPT_BATCH && (conn = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) >= 0; i++){
+		if (conn >= SNP_MAX_CONN || overlay_add(conn) < 0){
+			printf("server: can not serve overlay connection\n");
+			close(conn);
+		}
+	}
+}
+
+// This function initializes the TCB table marking all entries NULL and starts the event
+// loop. If ``conn'' is an overlay connection (conn >= 0) it is handed to the server stack,
+// which registers seghandler for it; pass -1 when the overlay connections are accepted with
+// srt_server_listen(). The stack owns every overlay connection from then on: when the peer
+// hangs up, the TCBs bound to it are closed and the descriptor is released and closed.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -50,14 +408,30 @@ void srt_server_init(int conn)
 		serverTCB[i] = NULL;
 	}
 
-	//Initialize the global variable for the overlay socked descriptor
-	serverconn = conn;
+	// SRT_DELACK=n acknowledges every n in-order DATA segments of new sockets
+	char* delack = getenv("SRT_DELACK");
+	if (delack != NULL){
+		if (atoi(delack) > 0){
+			delackSegs = atoi(delack);
+		}
+		else{
+			printf("SRT_DELACK: invalid segment count %s, using the default\n", delack);
+		}
+	}
 
-	//Start seghandler thread
-	pthread_t newthread;
-	int err = pthread_create(&newthread, NULL, seghandler, NULL);
-	if (err != 0){
-		printf("Seghandler thread creation failed\n");
+	//Create the TCB and receive buffer pools
+	if (tcbPool == NULL){
+		tcbPool = slab_create("server tcb", sizeof(svr_tcb_obj_t), TCB_PER_SLAB);
+		recvPool = slab_create("server receive buffer", RECEIVE_BUF_SIZE, 1);
+		if (tcbPool == NULL || recvPool == NULL){
+			printf("Slab pool creation failed\n");
+			exit(1);
+		}
+	}
+
+	//Start the event loop and hand it the overlay
+	if (evloop_start() < 0 || (conn >= 0 && overlay_add(conn) < 0)){
+		printf("Event loop start failed\n");
 		exit(1);
 	}
 
@@ -65,8 +439,41 @@ void srt_server_init(int conn)
 }
 
 
+// This function opens a TCP socket listening on the overlay port ``port'' and lets the event
+// loop accept any number of overlay connections on it, from any number of client hosts.
+// Every accepted connection is handed to the stack as srt_server_init() does. Segments are
+// demultiplexed by (overlay connection, client port, server port), so clients on different
+// hosts may use the same ports. Returns 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_server_listen(unsigned int port)
+{
+	struct sockaddr_in addr;
+	int on = 1;
+
+	int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenfd < 0){
+		return -1;
+	}
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(listenfd, SOMAXCONN) < 0
+			|| evloop_add_fd(listenfd, overlay_accept, (void *)(long)listenfd) < 0){
+		close(listenfd);
+		return -1;
+	}
+	printf("waiting for connection\n");
+	return 1;
+}
+
+
 // This function looks up the client TCB table to find the first NULL entry, and creates
-// a new TCB entry using malloc() for that entry. All fields in the TCB are initialized 
+// a new TCB entry taken from the TCB pool for that entry. All fields in the TCB are initialized 
 // e.g., TCB state is set to CLOSED and the server port set to the function call parameter 
 // server port.  The TCB table entry index should be returned as the new socket ID to the server 
 // and be used to identify the connection on the server side. If no entry in the TCB table  
@@ -77,38 +484,72 @@ void srt_server_init(int conn)
 //
 int srt_server_sock(unsigned int port)
 {
+	pthread_mutex_lock(&tableMutex);
 	for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
 		if (serverTCB[i] == NULL){
-			struct svr_tcb *newClient = malloc(sizeof(struct svr_tcb));
+			svr_tcb_obj_t *obj = slab_alloc(tcbPool);
+			if (obj == NULL){
+				pthread_mutex_unlock(&tableMutex);
+				printf("TCB allocation failed\n");
+				return -1;
+			}
+			struct svr_tcb *newClient = &obj->tcb;
 			newClient->svr_portNum = port;
+			newClient->overlay_conn = -1;
+			newClient->hashNext = NULL;
 			newClient->state = CLOSED;
 			serverTCB[i] = newClient;
+			pthread_mutex_unlock(&tableMutex);
 
-			newClient->recvBuf = malloc(RECEIVE_BUF_SIZE);
+			newClient->recvBuf = slab_alloc(recvPool);
+			newClient->readPos = 0;
 			newClient->usedBufLen = 0;
+			newClient->sackNum = 0;
+			newClient->rcvWin = 0;
+			newClient->rcvOffset = 0;
+			newClient->readOffset = 0;
+			newClient->mss = MAX_SEG_LEN;
+			newClient->ackEvery = delackSegs;
+			newClient->ackPending = 0;
+			memset(&newClient->acks, 0, sizeof(srt_ackstats_t));
 
 			//Initialize mutex
-			pthread_mutex_t *mutex;
-			mutex = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
-			if (pthread_mutex_init(mutex, NULL) != 0){
+			if (pthread_mutex_init(&obj->mutex, NULL) != 0){
 				printf("Mutex init failed\n");
 				return -1;
 			}
-			newClient->bufMutex = mutex;
+			newClient->bufMutex = &obj->mutex;
+
+			//Initialize the condition the blocking calls wait on, and the closewait and delayed ACK timers
+			newClient->bufCond = &obj->cond;
+			if (evloop_cond_init(newClient->bufCond) < 0){
+				printf("Cond init failed\n");
+				return -1;
+			}
+			newClient->closeTimer = evloop_timer_new(closewait, newClient);
+			newClient->ackTimer = evloop_timer_new(delayedack, newClient);
+			if (newClient->closeTimer == NULL || newClient->ackTimer == NULL){
+				printf("Timer init failed\n");
+				return -1;
+			}
 
 			return i;
 		}
 	}
+	pthread_mutex_unlock(&tableMutex);
   	// No more room in TCB table
   	return -1;
 }
 
 
 // This function gets the TCB pointer using the sockfd and changes the state of the connection to 
-// LISTENING. It then starts a timer to ``busy wait'' until the TCB's state changes to CONNECTED 
-// (seghandler does this when a SYN is received). It waits in an infinite loop for the state 
-// transition before proceeding and to return 1 when the state change happens, dropping out of
-// the busy wait loop. You can implement this blocking wait in different ways, if you wish.
+// LISTENING. It then waits on the TCB's condition until the TCB's state changes to CONNECTED 
+// (seghandler does this when a SYN is received and signals the condition), and returns 1
+// when the state change happens. The TCB is bound to the overlay connection and client port
+// of that SYN. A SYN that arrived while no TCB was listening on its port is kept in a backlog
+// of SYN_BACKLOG entries and taken by the next srt_server_accept() on the port.
+// The SYNACK agrees to the segment size the SYN proposes, lowered to what the overlay
+// connection carries (see snp_getmaxseg()), and MAX_SEG_LEN when the SYN proposes none.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -116,13 +557,40 @@ int srt_server_accept(int sockfd)
 {
 	//Get TCB pointer and change state to LISTENING
 	struct svr_tcb *tserver = serverTCB[sockfd];
+	pthread_mutex_lock(&tableMutex);
+	pthread_mutex_lock(tserver->bufMutex);
 	tserver->state = LISTENING;
 	printf("server is listening\n");
 	fflush(stdout);
 
+	//Take a SYN from the backlog and answer it
+	for (int i = 0; i < synBacklogLen; i++){
+		if (synBacklog[i].svr_port == tserver->svr_portNum){
+			SEGBUF(sizeof(srt_synopt_t)) segsend;
+			tcb_bind(tserver, synBacklog[i].conn, synBacklog[i].client_port);
+			tserver->mss = synBacklog[i].mss;
+			synBacklog[i] = synBacklog[--synBacklogLen];
+
+			synack_build(tserver, &segsend.seg);
+			snp_sendseg(tserver->overlay_conn, &segsend.seg);
+			printf("SYNACK sent\n");
+
+			tserver->state = CONNECTED;
+			tserver->expect_seqNum = 1;
+			tserver->rcvOffset = 0;
+			tserver->readOffset = 0;
+			tserver->sackNum = 0;
+			printf("CONNECTED\n");
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tableMutex);
+
 	while (tserver->state != CONNECTED){
-		//Wait forever until state is connected
+		//Wait until state is connected
+		pthread_cond_wait(tserver->bufCond, tserver->bufMutex);
 	}
+	pthread_mutex_unlock(tserver->bufMutex);
 	return 1;
 }
 
@@ -130,35 +598,71 @@ int srt_server_accept(int sockfd)
 // Receive data from a srt client. Recall this is a unidirectional transport
 // where DATA flows from the client to the server. Signaling/control messages
 // such as SYN, SYNACK, etc.flow in both directions. 
-// This function keeps polling the receive buffer every RECVBUF_POLLING_INTERVAL
+// This function waits on the TCB's condition, which seghandler signals as data arrives,
 // until the requested data is available, then it stores the data and returns 1
-// If the function fails, return -1 
+// If the function fails, return -1, which includes the connection closing before the
+// requested data has arrived.
+//
+// The receive buffer is a ring: srt_server_recv() copies the bytes out from the read cursor,
+// in two pieces when they wrap around its end, and advances the cursor, so the cost of a call
+// depends on length only, not on how much data the buffer holds. The caller's buffer holds
+// length bytes of data and a terminating 0, and is not otherwise cleared; a length of 0,
+// with no room for the terminating 0, fails.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 int srt_server_recv(int sockfd, void* buf, unsigned int length)
 {
 	struct svr_tcb *server = serverTCB[sockfd];
+	//length counts the terminating 0, so there is no room for it in a buffer of 0 bytes
+	if (length == 0){
+		return -1;
+	}
 	length = length -1;
 
-	//Make sure buf is empty
-	memset(buf, 0, sizeof(buf));
+	//The caller's buffer holds length + 1 bytes, the data and a terminating 0
+	((char*)buf)[length] = 0;
 
-	while (server->usedBufLen < length){	//Poll until requested info in buffer
-		sleep(RECVBUF_POLLING_INTERVAL);
+	pthread_mutex_lock(server->bufMutex);
+	while (server->usedBufLen < length){	//Wait until requested info in buffer
+		if (server->state == CLOSED){
+			pthread_mutex_unlock(server->bufMutex);
+			return -1;
+		}
+		pthread_cond_wait(server->bufCond, server->bufMutex);
+	}
+	//seghandler only writes past usedBufLen, which still covers these bytes, so they are
+	//copied out without the mutex, in two pieces when they wrap around the end of the ring
+	unsigned int pos = server->readPos;
+	pthread_mutex_unlock(server->bufMutex);
+	unsigned int first = RECEIVE_BUF_SIZE - pos;
+	if (length <= first){
+		memcpy(buf, server->recvBuf + pos, length);
+	}
+	else{
+		memcpy(buf, server->recvBuf + pos, first);
+		memcpy((char*)buf + first, server->recvBuf, length - first);
 	}
 	pthread_mutex_lock(server->bufMutex);
-	memcpy(buf, server->recvBuf, length);
-	memmove(server->recvBuf, server->recvBuf + length, server->usedBufLen - length);
-	memset(server->recvBuf + server->usedBufLen - length, 0, RECEIVE_BUF_SIZE - server->usedBufLen + length);
+	server->readPos = pos + length < RECEIVE_BUF_SIZE ? pos + length : pos + length - RECEIVE_BUF_SIZE;
 	server->usedBufLen = server->usedBufLen - length;
+	server->readOffset += length;
+
+	//Tell the client when the window it last heard of has at least doubled and grown by a
+	//segment, so a client stopped by a small or zero window need not wait for its next probe
+	unsigned int win = RECEIVE_BUF_SIZE - 1 - server->usedBufLen;
+	if (server->state == CONNECTED && win >= 2 * server->rcvWin && win >= server->rcvWin + server->mss){
+		SEGBUF(MAX_SEG_LEN) segsend;
+		ack_build(server, &segsend.seg);
+		snp_sendseg(server->overlay_conn, &segsend.seg);
+	}
 	pthread_mutex_unlock(server->bufMutex);
 	return 1;
 
 }
 
 
-// This function calls free() to free the TCB entry. It marks that entry in TCB as NULL
+// This function returns the TCB entry and its buffers to their pools. It marks that entry in TCB as NULL
 // and returns 1 if succeeded (i.e., was in the right state to complete a close) and -1 
 // if fails (i.e., in the wrong state).
 //
@@ -167,140 +671,259 @@ int srt_server_recv(int sockfd, void* buf, unsigned int length)
 int srt_server_close(int sockfd)
 {
 	struct svr_tcb *srtserver = serverTCB[sockfd];
+	pthread_mutex_lock(srtserver->bufMutex);
 	while (srtserver->state != CLOSED){
-		// wait for seghandler to receive FIN
+		// wait for seghandler to receive FIN and the closewait timer to expire
+		pthread_cond_wait(srtserver->bufCond, srtserver->bufMutex);
 	} 
+	pthread_mutex_unlock(srtserver->bufMutex);
+
+	// Take the TCB out of the table; once its timer is freed the event loop no longer runs
+	// a callback that could hold it
+	pthread_mutex_lock(&tableMutex);
+	tcb_unbind(srtserver);
+	serverTCB[sockfd] = NULL;
+	pthread_mutex_unlock(&tableMutex);
 
-	// Free TCB struct and reset table entry
+	// Free TCB struct
+	evloop_timer_free(srtserver->closeTimer);
+	evloop_timer_free(srtserver->ackTimer);
+	pthread_cond_destroy(srtserver->bufCond);
 	pthread_mutex_destroy(srtserver->bufMutex);
-	free(srtserver->recvBuf);
+	slab_free(recvPool, srtserver->recvBuf);
+	srtserver->readPos = 0;
 	srtserver->usedBufLen = 0;
-	free(srtserver);
-	serverTCB[sockfd] = NULL;
+	slab_free(tcbPool, srtserver);
+	return 1;
+}
+
+
+// Set the number of in-order DATA segments per DATAACK.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_server_setdelack(int sockfd, unsigned int segs)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || serverTCB[sockfd] == NULL || segs == 0){
+		return -1;
+	}
+	struct svr_tcb *srtserver = serverTCB[sockfd];
+	pthread_mutex_lock(srtserver->bufMutex);
+	srtserver->ackEvery = segs;
+	pthread_mutex_unlock(srtserver->bufMutex);
+	return 1;
+}
+
+
+// Copy the DATA and DATAACK counters of the socket.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_server_getackstats(int sockfd, srt_ackstats_t* acks)
+{
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || serverTCB[sockfd] == NULL){
+		return -1;
+	}
+	struct svr_tcb *srtserver = serverTCB[sockfd];
+	pthread_mutex_lock(srtserver->bufMutex);
+	*acks = srtserver->acks;
+	pthread_mutex_unlock(srtserver->bufMutex);
 	return 1;
 }
 
 
-// This is a thread  started by srt_server_init(). It handles all the incoming 
-// segments from the client. The design of seghanlder is an infinite loop that calls snp_recvseg(). If
-// snp_recvseg() fails then the overlay connection is closed and the thread is terminated. Depending
-// on the state of the connection when a segment is received  (based on the incoming segment) various
-// actions are taken. See the client FSM for more details.
+// Copy the 64-bit stream offsets of the socket.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
-void* seghandler(void* arg)
+int srt_server_getoffsets(int sockfd, unsigned long long* received, unsigned long long* read)
 {
+	if (sockfd < 0 || sockfd >= MAX_TRANSPORT_CONNECTIONS || serverTCB[sockfd] == NULL || received == NULL || read == NULL){
+		return -1;
+	}
+	struct svr_tcb *srtserver = serverTCB[sockfd];
+	pthread_mutex_lock(srtserver->bufMutex);
+	*received = srtserver->rcvOffset;
+	*read = srtserver->readOffset;
+	pthread_mutex_unlock(srtserver->bufMutex);
+	return 1;
+}
 
-	while (1){
-	seg_t segrec;
-	seg_t segsend;
 
-		if ( snp_recvseg(serverconn, &segrec)){
+// This function returns the overlay connection the TCB is bound to, or -1 if it is not
+// connected.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+int srt_server_getconn(int sockfd)
+{
+	struct svr_tcb *srtserver = serverTCB[sockfd];
+	pthread_mutex_lock(srtserver->bufMutex);
+	int conn = srtserver->overlay_conn;
+	pthread_mutex_unlock(srtserver->bufMutex);
+	return conn;
+}
 
-			// Identify which TCB the message corresponds to
-			struct svr_tcb *srtserver;
-			for (int i = 0; i < MAX_TRANSPORT_CONNECTIONS; i++){
-				if (serverTCB[i] != NULL){
-					if (segrec.header.dest_port == serverTCB[i]->svr_portNum){
-						srtserver = serverTCB[i];
-					}
-				}
+
+// This is the callback the server stack registers with the event loop for every overlay
+// connection, which arg holds. It handles all the incoming segments from the client each time
+// the overlay is readable, calling snp_tryrecvseg() until no complete segment is left, and then
+// sends the queued replies in one burst. Every segment goes to the TCB bound to its overlay
+// connection and ports. If snp_tryrecvseg() fails then the TCBs bound to the overlay
+// connection are closed and the connection is released and closed. Depending on the state of the connection when a segment is received  (based on the
+// incoming segment) various actions are taken. See the client FSM for more details.
+// Every segment is handled under the TCB's mutex and its condition is signaled afterwards,
+// so the blocking calls see the new state or data.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+void seghandler(void* arg)
+{
+	int conn = (int)(long)arg;
+	seg_t *segrec = &rxSeg.seg;
+	SEGBUF(MAX_SEG_LEN) sendbuf;
+	seg_t *segsend = &sendbuf.seg;
+	int m;
+
+	while ((m = snp_tryrecvseg(conn, segrec)) > 0){
+		memset(&segsend->header, 0, sizeof(srt_hdr_t));
+
+		// Identify which TCB the message corresponds to
+		pthread_mutex_lock(&tableMutex);
+		struct svr_tcb *srtserver = tcb_lookup(conn, segrec);
+		if (srtserver == NULL){
+			if (segrec->header.type == SYN){
+				syn_backlog_add(conn, segrec);
 			}
+			pthread_mutex_unlock(&tableMutex);
+			continue;
+		}
 
-			// Add client port to TCB
-			srtserver->client_portNum = segrec.header.src_port;
-
-			// //Set up segment
-			segsend.header.src_port = srtserver->svr_portNum;
-			segsend.header.dest_port = srtserver->client_portNum;
-
-
-			// Handle for each state
-			switch(srtserver->state){
-				case CLOSED:
-					break;
-				case LISTENING:
-					if (segrec.header.type == SYN){
-
-						// Send SYNACK
-						segsend.header.length = 0;
-						segsend.header.ack_num = 1; 
-						segsend.header.type = SYNACK;
-						snp_sendseg(serverconn, &segsend);
-						printf("SYNACK sent\n");
-						
-						// Transition to connected state
-						srtserver->state = CONNECTED;
-						srtserver->expect_seqNum = 1; 
-						printf("CONNECTED\n");
+		pthread_mutex_lock(srtserver->bufMutex);
 
+		// Bind a listening TCB to the client's overlay connection and port
+		if (srtserver->state == LISTENING){
+			tcb_bind(srtserver, conn, segrec->header.src_port);
+		}
+		pthread_mutex_unlock(&tableMutex);
+
+		// //Set up segment
+		segsend->header.src_port = srtserver->svr_portNum;
+		segsend->header.dest_port = srtserver->client_portNum;
+
+
+		// Handle for each state
+		switch(srtserver->state){
+			case CLOSED:
+				break;
+			case LISTENING:
+				if (segrec->header.type == SYN){
+
+					// Send SYNACK with the agreed segment size
+					srtserver->mss = syn_mss(conn, segrec);
+					synack_build(srtserver, segsend);
+					reply_queue(conn, segsend);
+					printf("SYNACK sent\n");
+					
+					// Transition to connected state
+					srtserver->state = CONNECTED;
+					srtserver->expect_seqNum = 1; 
+					srtserver->rcvOffset = 0;
+					srtserver->readOffset = 0;
+					srtserver->sackNum = 0;
+					printf("CONNECTED\n");
+
+				}
+				break;
+			case CONNECTED:
+				if (segrec->header.type == SYN){
+					synack_build(srtserver, segsend);
+					reply_queue(conn, segsend);
+					printf("SYNACK re-sent\n");
+				}
+				else if (segrec->header.type == FIN){
+					// ACK the data still waiting for a delayed ACK, then send FINACK and
+					// transition to closewait
+					if (srtserver->ackPending > 0){
+						SEGBUF(MAX_SEG_LEN) segack;
+						ack_build(srtserver, &segack.seg);
+						reply_queue(conn, &segack.seg);
 					}
-					break;
-				case CONNECTED:
-					if (segrec.header.type == SYN){
-						segsend.header.type = SYNACK;
-						snp_sendseg(serverconn, &segsend);
-						printf("SYNACK re-sent\n");
-					}
-					else if (segrec.header.type == FIN){
-						// Send FINACK and Transition to closewait
-						segsend.header.type = FINACK;
-						snp_sendseg(serverconn, &segsend);
-						printf("FINACK sent\n");
-						srtserver->state = CLOSEWAIT;
-
-						//Start a closewait timer
-						pthread_t cwtimer; 
-						pthread_create(&cwtimer, NULL, closewait, (void*)srtserver);
-					}
-					else if (segrec.header.type = DATA){
-						// Lock Mutex
-						pthread_mutex_lock(srtserver->bufMutex);
-						segsend.header.type = DATAACK;
-						if ((segrec.header.seq_num == srtserver->expect_seqNum) && (srtserver->usedBufLen + segrec.header.length < RECEIVE_BUF_SIZE)){
-							//strncat(srtserver->recvBuf, segrec.data, segrec.header.length);
-							memmove(srtserver->recvBuf + srtserver->usedBufLen, segrec.data, segrec.header.length);
-							srtserver->expect_seqNum += segrec.header.length;
-							srtserver->usedBufLen += segrec.header.length;
-							segsend.header.seq_num = srtserver->expect_seqNum;
-							if (snp_sendseg(serverconn, &segsend)){
-								printf("DATAACK sent\n");
-							}
+					segsend->header.type = FINACK;
+					reply_queue(conn, segsend);
+					printf("FINACK sent\n");
+					srtserver->state = CLOSEWAIT;
 
+					//Start the closewait timer
+					evloop_timer_set(srtserver->closeTimer, CLOSEWAIT_TIMEOUT * 1000000000LL);
+				}
+				else if (segrec->header.type == DATA){
+					// Keep the segment in order or out of order, then ACK everything held in
+					// order and report the out-of-order ranges as selective ACK blocks.
+					// A segment that just extends the in-order data waits for ackEvery of
+					// them or the delayed ACK timer; anything else is ACKed at once
+					unsigned int expect = srtserver->expect_seqNum;
+					unsigned int sacks = srtserver->sackNum;
+					srtserver->acks.data++;
+					reasm_add(srtserver, segrec);
+					if (segrec->header.length > 0 && sacks == 0 && srtserver->sackNum == 0
+							&& srtserver->expect_seqNum - expect == segrec->header.length
+							&& ++srtserver->ackPending < srtserver->ackEvery){
+						if (srtserver->ackPending == 1){
+							evloop_timer_set(srtserver->ackTimer, DELACK_TIMEOUT);
 						}
-						else{	
-							segsend.header.seq_num = srtserver->expect_seqNum;
-							snp_sendseg(serverconn, &segsend);
-						}
-						pthread_mutex_unlock(srtserver->bufMutex);
 					}
-
-					break;
-				case CLOSEWAIT:
-					if (segrec.header.type == FIN){
-						//Resend FINACK
-						segsend.header.type = FINACK;
-						snp_sendseg(serverconn, &segsend);
-						printf("FINACK re-sent\n");
+					else{
+						ack_build(srtserver, segsend);
+						if (reply_queue(conn, segsend) > 0 && srtserver->expect_seqNum != expect){
+							printf("DATAACK sent\n");
+						}
 					}
-					break;
-			}
+				}
 
+				break;
+			case CLOSEWAIT:
+				if (segrec->header.type == FIN){
+					//Resend FINACK
+					segsend->header.type = FINACK;
+					reply_queue(conn, segsend);
+					printf("FINACK re-sent\n");
+				}
+				break;
 		}
-		else {
-			printf("server: received message failed\n");
-			exit(1);
-		}
+		pthread_cond_broadcast(srtserver->bufCond);
+		pthread_mutex_unlock(srtserver->bufMutex);
+	}
+
+	// Send the replies to everything handled in one burst
+	reply_flush(conn);
+	if (m < 0){
+		overlay_drop(conn);
 	}
 }
 
-void* closewait(void* servertcb) {
+// This timer callback is armed by seghandler when a FIN moves a connection to CLOSEWAIT.
+// The event loop runs it CLOSEWAIT_TIMEOUT seconds later to close the connection.
+void closewait(void* servertcb) {
 	svr_tcb_t* my_servertcb = (svr_tcb_t*)servertcb;
-	sleep(CLOSEWAIT_TIMEOUT);
+	pthread_mutex_lock(&tableMutex);
+	pthread_mutex_lock(my_servertcb->bufMutex);
 	my_servertcb->state = CLOSED;
+	tcb_unbind(my_servertcb);
 	printf("CLOSED\n");
-	return NULL;
+	pthread_cond_broadcast(my_servertcb->bufCond);
+	pthread_mutex_unlock(my_servertcb->bufMutex);
+	pthread_mutex_unlock(&tableMutex);
 }
 
-
+void delayedack(void* servertcb) {
+	svr_tcb_t* my_servertcb = (svr_tcb_t*)servertcb;
+	SEGBUF(MAX_SEG_LEN) segsend;
+	pthread_mutex_lock(my_servertcb->bufMutex);
+	if (my_servertcb->state == CONNECTED && my_servertcb->ackPending > 0){
+		ack_build(my_servertcb, &segsend.seg);
+		my_servertcb->acks.delayed++;
+		snp_sendseg(my_servertcb->overlay_conn, &segsend.seg);
+	}
+	pthread_mutex_unlock(my_servertcb->bufMutex);
+}
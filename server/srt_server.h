@@ -19,6 +19,7 @@
 
 #include "../common/seg.h"
 #include "../common/constants.h"
+#include "../common/evloop.h"
 
 //server states used in FSM
 #define	CLOSED 1
@@ -27,17 +28,39 @@
 #define	CLOSEWAIT 4
 
 
+//DATA and DATAACK counters of a connection, see srt_server_getackstats()
+typedef struct srt_ackstats {
+	unsigned long data;             //DATA segments received
+	unsigned long acks;             //DATAACKs sent
+	unsigned long delayed;          //DATAACKs sent by the delayed ACK timer
+} srt_ackstats_t;
+
 //server transport control block. the server side of a SRT connection uses this data structure to keep track of the connection information.
 typedef struct svr_tcb {
 	unsigned int svr_nodeID;        //node ID of server, similar as IP address, currently unused
 	unsigned int svr_portNum;       //port number of server
 	unsigned int client_nodeID;     //node ID of client, similar as IP address, currently unused
 	unsigned int client_portNum;    //port number of client
+	int overlay_conn;               //overlay connection the client's SYN arrived on, -1 while unbound
 	unsigned int state;         	//state of server
 	unsigned int expect_seqNum;     //the server's expecting data sequence number	
-	char* recvBuf;                  //a pointer pointing to the receive buffer
-	unsigned int  usedBufLen;       //size of the received data in receive buffer
+	unsigned long long rcvOffset;   //stream offset of expect_seqNum: the data bytes received in order since the connection was made
+	unsigned long long readOffset;  //data bytes srt_server_recv() has handed to the application
+	char* recvBuf;                  //a pointer pointing to the receive buffer, a ring of RECEIVE_BUF_SIZE bytes
+	unsigned int readPos;           //read cursor: index in recvBuf of the next byte srt_server_recv() hands out
+	unsigned int  usedBufLen;       //size of the received data in receive buffer, in order from readPos
+	srt_sack_t sack[SACK_MAX_BLOCKS];//data ranges beyond expect_seqNum received out of order, in sequence order
+	unsigned int sackNum;           //number of ranges in sack, whose data already sits in recvBuf past usedBufLen
+	unsigned int rcvWin;            //receive window last advertised to the client, in bytes beyond expect_seqNum
+	unsigned int mss;               //segment size agreed with the client in the SYN and SYNACK
+	unsigned int ackEvery;          //in-order DATA segments per DATAACK, see srt_server_setdelack()
+	unsigned int ackPending;        //in-order DATA segments received since the last DATAACK
+	srt_ackstats_t acks;            //DATA and DATAACK counters
 	pthread_mutex_t* bufMutex;      //a pointer pointing to the mutex which is used for receive buffer access
+	pthread_cond_t* bufCond;        //signaled by seghandler and closewait when the state or the receive buffer changes
+	evloop_timer_t* closeTimer;     //runs closewait CLOSEWAIT_TIMEOUT after a FIN
+	evloop_timer_t* ackTimer;       //runs delayedack DELACK_TIMEOUT after the first in-order DATA segment not yet ACKed
+	struct svr_tcb* hashNext;       //next TCB in the same demultiplexing hash chain
 } svr_tcb_t;
 
 
@@ -60,11 +83,24 @@ typedef struct svr_tcb {
 
 void srt_server_init(int conn);
 
-// This function initializes the TCB table marking all entries NULL. It also initializes 
-// a global variable for the overlay TCP socket descriptor ``conn'' used as input parameter
-// for snp_sendseg and snp_recvseg. Finally, the function starts the seghandler thread to 
-// handle the incoming segments. There is only one seghandler for the server side which
-// handles call connections for the client.
+// This function initializes the TCB table marking all entries NULL and starts the event
+// loop. If ``conn'' is an overlay connection (conn >= 0) it is handed to the server stack,
+// which registers seghandler for it; pass -1 when the overlay connections are accepted with
+// srt_server_listen(). The stack owns every overlay connection from then on: when the peer
+// hangs up, the TCBs bound to it are closed and the descriptor is released and closed.
+// The SRT_DELACK environment variable sets the number of in-order DATA segments per DATAACK
+// of the sockets created afterwards, DELACK_SEGS if it is not set; see srt_server_setdelack().
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_server_listen(unsigned int port);
+
+// This function opens a TCP socket listening on the overlay port ``port'' and lets the event
+// loop accept any number of overlay connections on it, from any number of client hosts.
+// Every accepted connection is handed to the stack as srt_server_init() does. Segments are
+// demultiplexed by (overlay connection, client port, server port), so clients on different
+// hosts may use the same ports. Returns 1 in case of success, and -1 in case of failure.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -72,7 +108,7 @@ void srt_server_init(int conn);
 int srt_server_sock(unsigned int port);
 
 // This function looks up the client TCB table to find the first NULL entry, and creates
-// a new TCB entry using malloc() for that entry. All fields in the TCB are initialized 
+// a new TCB entry taken from the TCB pool for that entry. All fields in the TCB are initialized 
 // e.g., TCB state is set to CLOSED and the server port set to the function call parameter 
 // server port.  The TCB table entry index should be returned as the new socket ID to the server 
 // and be used to identify the connection on the server side. If no entry in the TCB table  
@@ -85,10 +121,13 @@ int srt_server_sock(unsigned int port);
 int srt_server_accept(int sockfd);
 
 // This function gets the TCB pointer using the sockfd and changes the state of the connection to 
-// LISTENING. It then starts a timer to ``busy wait'' until the TCB's state changes to CONNECTED 
-// (seghandler does this when a SYN is received). It waits in an infinite loop for the state 
-// transition before proceeding and to return 1 when the state change happens, dropping out of
-// the busy wait loop. You can implement this blocking wait in different ways, if you wish.
+// LISTENING. It then waits on the TCB's condition until the TCB's state changes to CONNECTED 
+// (seghandler does this when a SYN is received and signals the condition), and returns 1
+// when the state change happens. The TCB is bound to the overlay connection and client port
+// of that SYN. A SYN that arrived while no TCB was listening on its port is kept in a backlog
+// of SYN_BACKLOG entries and taken by the next srt_server_accept() on the port.
+// The SYNACK agrees to the segment size the SYN proposes, lowered to what the overlay
+// connection carries (see snp_getmaxseg()), and MAX_SEG_LEN when the SYN proposes none.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
@@ -98,35 +137,103 @@ int srt_server_recv(int sockfd, void* buf, unsigned int length);
 // Receive data from a srt client. Recall this is a unidirectional transport
 // where DATA flows from the client to the server. Signaling/control messages
 // such as SYN, SYNACK, etc.flow in both directions. 
-// This function keeps polling the receive buffer every RECVBUF_POLLING_INTERVAL
+// This function waits on the TCB's condition, which seghandler signals as data arrives,
 // until the requested data is available, then it stores the data and returns 1
-// If the function fails, return -1 
+// If the function fails, return -1, which includes the connection closing before the
+// requested data has arrived.
 //
 // Note that srt_server_recv blocked waiting for the user requested number
 // of bytes (i.e., length) are at the server before returning data to the application
 //
+// The receive buffer is a ring: srt_server_recv() copies the bytes out from the read cursor,
+// in two pieces when they wrap around its end, and advances the cursor, so the cost of a call
+// depends on length only, not on how much data the buffer holds. The caller's buffer holds
+// length bytes of data and a terminating 0, and is not otherwise cleared; a length of 0,
+// with no room for the terminating 0, fails.
+//
+// Once the bytes it hands to the application have at least doubled the receive window last
+// advertised to the client, by a segment or more, it sends a DATAACK with the new window so a
+// client stalled on a full receive buffer resumes without waiting for its probe timer.
+//
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 
 int srt_server_close(int sockfd);
 
-// This function calls free() to free the TCB entry. It marks that entry in TCB as NULL
+// This function returns the TCB entry and its buffers to their pools. It marks that entry in TCB as NULL
 // and returns 1 if succeeded (i.e., was in the right state to complete a close) and -1 
 // if fails (i.e., in the wrong state).
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
 
-void* seghandler(void* arg);
+int srt_server_setdelack(int sockfd, unsigned int segs);
+
+// Set the number of in-order DATA segments the socket acknowledges with one DATAACK,
+// DELACK_SEGS by default. The DATAACK goes out once segs segments wait for it, or DELACK_TIMEOUT
+// after the first of them. A segment that arrives out of order, fills a gap, repeats data already
+// received or carries no data is ACKed at once, with the ones waiting, so duplicate ACKs and
+// window probes reach the client without delay; so is a FIN. 1 ACKs every segment.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_server_getackstats(int sockfd, srt_ackstats_t* acks);
+
+// Copy the DATA and DATAACK counters of the socket into acks.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_server_getoffsets(int sockfd, unsigned long long* received, unsigned long long* read);
+
+// Copy the stream offsets of the socket since it connected: the data bytes received in order
+// in *received and the data bytes handed to the application in *read. The sequence number of
+// a byte is its offset plus 1 in 32 bits, which wraps every 4 GB; sequence numbers are only
+// compared with SEQ_LT() and friends, so a connection carries any number of bytes.
+// Return 1 in case of success, and -1 in case of failure.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+int srt_server_getconn(int sockfd);
+
+// This function returns the overlay connection the TCB is bound to, or -1 if it is not
+// connected.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+void seghandler(void* arg);
+
+// This is the callback the server stack registers with the event loop for every overlay
+// connection, which arg holds. It handles all the incoming segments from the client each time
+// the overlay is readable, calling snp_tryrecvseg() until no complete segment is left, and then
+// sends the queued replies in one burst. Every segment goes to the TCB bound to its overlay
+// connection and ports. If snp_tryrecvseg() fails then the TCBs bound to the overlay
+// connection are closed and the connection is released and closed. Depending on the state of the connection when a segment is received  (based on the
+// incoming segment) various actions are taken. See the client FSM for more details.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+void closewait(void* servertcb);
+
+// This timer callback is armed by seghandler when a FIN moves a connection to CLOSEWAIT.
+// The event loop runs it CLOSEWAIT_TIMEOUT seconds later to close the connection.
+//
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+
+void delayedack(void* servertcb);
 
-// This is a thread  started by srt_server_init(). It handles all the incoming 
-// segments from the client. The design of seghanlder is an infinite loop that calls snp_recvseg(). If
-// snp_recvseg() fails then the overlay connection is closed and the thread is terminated. Depending
-// on the state of the connection when a segment is received  (based on the incoming segment) various
-// actions are taken. See the client FSM for more details.
+// This timer callback is armed by seghandler when it leaves an in-order DATA segment
+// unacknowledged. The event loop runs it DELACK_TIMEOUT later to send the DATAACK for the
+// segments still waiting for one.
 //
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //
-void* closewait(void* servertcb);
 
 #endif